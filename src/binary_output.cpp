@@ -0,0 +1,460 @@
+#include "binary_output.h"
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char magic[8] = {'S','D','F','G','R','I','D','1'};
+
+// Returns the channel with the given name, or nullptr.
+const Channel *SDFGrid::find(std::string name) const {
+    for (auto &c: channels) if (c.name == name) return &c;
+    return nullptr;
+}
+
+template <typename T>
+static Channel make_raw_channel(std::string name, const Array3<T, Array1<T> > &grid,
+                                Encoding e, float scale) {
+    Channel c;
+    c.name = name;
+    c.encoding = e;
+    c.scale = scale;
+    c.external = (const char*)grid.a.data;
+    return c;
+}
+
+// Makes a channel referring to the grid in its native encoding.
+Channel make_channel(std::string name, const Array3f &grid) {
+    return make_raw_channel(name, grid, ENCODE_FLOAT32, 1);
+}
+
+Channel make_channel(std::string name, const Array3i &grid) {
+    return make_raw_channel(name, grid, ENCODE_INT32, 1);
+}
+
+// Makes a channel referring to 16-bit data produced by quantize().
+Channel make_channel(std::string name, const Array3us &grid, Encoding e, float scale) {
+    return make_raw_channel(name, grid, e, scale);
+}
+
+static std::ofstream open_binary(std::string output) {
+    std::ofstream fid(output, std::ios::out|std::ios::binary);
+    if (!fid) {
+        std::cerr << "Failed to open " << output << " for writing. Terminating.\n";
+        exit(-1);
+    }
+    fid.write(magic, sizeof(magic));
+    return fid;
+}
+
+static void write_grid_header(std::ofstream &fid, const SDFGrid &g) {
+    int header[4] = {g.level, g.ni, g.nj, g.nk};
+    float geometry[4] = {g.origin[0], g.origin[1], g.origin[2], g.dx};
+    int num_channels = (int)g.channels.size();
+    fid.write((char*)header, sizeof(header));
+    fid.write((char*)geometry, sizeof(geometry));
+    fid.write((char*)&num_channels, sizeof(num_channels));
+}
+
+static void write_channel_header(std::ofstream &fid, const Channel &c) {
+    char name[16] = {0};
+    std::strncpy(name, c.name.c_str(), sizeof(name)-1);
+    int encoding = c.encoding;
+    fid.write(name, sizeof(name));
+    fid.write((char*)&encoding, sizeof(encoding));
+    fid.write((char*)&c.scale, sizeof(c.scale));
+}
+
+// Writes grids as records of a binary SDF file.
+void write_as_binary(std::string output, const std::vector<SDFGrid> &grids) {
+    auto fid = open_binary(output);
+    for (auto &g: grids) {
+        write_grid_header(fid, g);
+        for (auto &c: g.channels) {
+            write_channel_header(fid, c);
+            size_t n = (size_t)g.ni*g.nj*g.nk;
+            fid.write(c.data(), n*encoding_size(c.encoding));
+        }
+    }
+}
+
+// Writes consecutive slabs along k as one grid record.
+void write_slabs_as_binary(std::string output, const std::vector<SDFGrid> &slabs) {
+    auto fid = open_binary(output);
+    SDFGrid g;
+    g.level = slabs[0].level;
+    g.ni = slabs[0].ni; g.nj = slabs[0].nj; g.nk = 0;
+    g.origin = slabs[0].origin;
+    g.dx = slabs[0].dx;
+    g.channels.resize(slabs[0].channels.size());
+    for (auto &s: slabs) g.nk += s.nk;
+    write_grid_header(fid, g);
+    for (size_t c=0; c<g.channels.size(); ++c) {
+        write_channel_header(fid, slabs[0].channels[c]);
+        for (auto &s: slabs) {
+            size_t n = (size_t)s.ni*s.nj*s.nk;
+            fid.write(s.channels[c].data(), n*encoding_size(s.channels[c].encoding));
+        }
+    }
+    if (!fid) {
+        std::cerr << "Failed to write " << output << ". Terminating.\n";
+        exit(-1);
+    }
+}
+
+// Writes one grid record generated slab by slab.
+void write_generated_as_binary(std::string output, const SDFGrid &g, int slab_layers,
+                               const std::function<void(int, int, int, char*)> &fill) {
+    auto fid = open_binary(output);
+    write_grid_header(fid, g);
+    size_t layer = (size_t)g.ni*g.nj;
+    for (size_t c=0; c<g.channels.size(); ++c) {
+        write_channel_header(fid, g.channels[c]);
+        size_t bytes = layer*encoding_size(g.channels[c].encoding);
+        std::vector<char> slab(slab_layers*bytes);
+        for (int k0=0; k0<g.nk; k0+=slab_layers) {
+            int k1 = min(k0+slab_layers, g.nk);
+            fill(c, k0, k1, slab.data());
+            fid.write(slab.data(), (k1-k0)*bytes);
+        }
+    }
+    if (!fid) {
+        std::cerr << "Failed to write " << output << ". Terminating.\n";
+        exit(-1);
+    }
+}
+
+// Makes the grid record of a phi grid in the given precision, plus any extra channels.
+SDFGrid make_level_set_grid(const Array3f &phi, const Vec3f &origin, float dx, Encoding e,
+                            float band, const Array3i *closest_tri,
+                            const LevelSetChannels *channels, float &max_error, int level) {
+    SDFGrid g;
+    g.level = level;
+    g.ni = phi.ni; g.nj = phi.nj; g.nk = phi.nk;
+    g.origin = origin;
+    g.dx = dx;
+    max_error = 0;
+    if (e == ENCODE_FLOAT32) {
+        g.channels.push_back(make_channel("phi", phi));
+    }
+    else {
+        Channel c;
+        c.name = "phi";
+        c.encoding = e;
+        c.scale = quantize_scale(phi.a.data, phi.a.size(), e, band);
+        c.storage.resize(phi.a.size()*sizeof(unsigned short));
+        max_error = quantize_values(phi.a.data, phi.a.size(), e, band, c.scale,
+                                    (unsigned short*)c.storage.data());
+        g.channels.push_back(c);
+    }
+    if (closest_tri) {
+        g.channels.push_back(make_channel("closest_tri", *closest_tri));
+    }
+    const char *axes[3] = {"_x", "_y", "_z"};
+    for (int c=0; channels && channels->closest_points && c<3; ++c) {
+        g.channels.push_back(make_channel(std::string("closest")+axes[c], channels->closest[c]));
+    }
+    for (int c=0; channels && channels->gradients && c<3; ++c) {
+        g.channels.push_back(make_channel(std::string("gradient")+axes[c], channels->gradient[c]));
+    }
+    if (channels && channels->objects) {
+        g.channels.push_back(make_channel("object", channels->object));
+    }
+    return g;
+}
+
+// Writes a phi grid in the given precision, plus any extra channels.
+float write_as_binary(std::string output, const Array3f &phi, const Vec3f &origin, float dx,
+                      Encoding e, float band, const Array3i *closest_tri,
+                      const LevelSetChannels *channels) {
+    float max_error;
+    auto g = make_level_set_grid(phi, origin, dx, e, band, closest_tri, channels, max_error);
+    write_as_binary(output, std::vector<SDFGrid>(1, g));
+    return max_error;
+}
+
+AsyncBinaryWriter::AsyncBinaryWriter(std::string output, const Vec3f &origin, float dx,
+                                     Encoding e, float band, bool write_tri,
+                                     const std::vector<int> *tri_map)
+    : output(output), origin(origin), dx(dx), band(band), scale(1), max_error(0),
+      encoding(e), write_tri(write_tri), tri_map(tri_map), fd(-1), current(0), done(false) {
+    slabs[0].data = slabs[1].data = nullptr;
+}
+
+AsyncBinaryWriter::~AsyncBinaryWriter() {
+    if (writer.joinable()) finish();
+    free(slabs[0].data);
+    free(slabs[1].data);
+}
+
+// Lays out the file, writes every header and starts the writer thread.
+void AsyncBinaryWriter::begin(const Array3f &phi, const Array3i &closest_tri,
+                              const LevelSetChannels *channels) {
+    ni = phi.ni; nj = phi.nj; nk = phi.nk;
+    size_t n = (size_t)ni*nj*nk;
+    // |phi| is final, so the int16 scale is too.
+    scale = quantize_scale(phi.a.data, n, encoding, band);
+    sources.push_back(Source{"phi", phi.a.data, encoding, scale, 0});
+    if (write_tri) sources.push_back(Source{"closest_tri", closest_tri.a.data, ENCODE_INT32, 1, 0});
+    const char *axes[3] = {"_x", "_y", "_z"};
+    for (int c=0; channels && channels->closest_points && c<3; ++c) {
+        sources.push_back(Source{std::string("closest")+axes[c], channels->closest[c].a.data, ENCODE_FLOAT32, 1, 0});
+    }
+    for (int c=0; channels && channels->gradients && c<3; ++c) {
+        sources.push_back(Source{std::string("gradient")+axes[c], channels->gradient[c].a.data, ENCODE_FLOAT32, 1, 0});
+    }
+    if (channels && channels->objects) {
+        sources.push_back(Source{"object", channels->object.a.data, ENCODE_INT32, 1, 0});
+    }
+
+    SDFGrid g;
+    g.level = 0;
+    g.ni = ni; g.nj = nj; g.nk = nk;
+    g.origin = origin;
+    g.dx = dx;
+    g.channels.resize(sources.size());
+    auto fid = open_binary(output);
+    write_grid_header(fid, g);
+    size_t cell_bytes = 0;
+    for (auto &src: sources) {
+        Channel c;
+        c.name = src.name;
+        c.encoding = src.encoding;
+        c.scale = src.scale;
+        write_channel_header(fid, c);
+        src.offset = fid.tellp();
+        fid.seekp(n*encoding_size(src.encoding), std::ios::cur);
+        cell_bytes += encoding_size(src.encoding);
+    }
+    size_t size = fid.tellp();
+    fid.close();
+    fd = open(output.c_str(), O_WRONLY);
+    if (!fid || fd < 0 || ftruncate(fd, size) != 0) {
+        std::cerr << "Failed to open " << output << " for writing. Terminating.\n";
+        exit(-1);
+    }
+
+    // Slabs of about 4 MB, aligned for direct transfer to the page cache.
+    size_t layer_bytes = (size_t)ni*nj*cell_bytes;
+    slab_layers = max<size_t>(1, (4u << 20)/max<size_t>(layer_bytes, 1));
+    for (auto &slab: slabs) {
+        if (posix_memalign((void**)&slab.data, 4096, slab_layers*layer_bytes) != 0) {
+            std::cerr << "Out of memory for output buffers. Terminating.\n";
+            exit(-1);
+        }
+        slab.busy = false;
+    }
+    next_k = first_pending = 0;
+    writer = std::thread(&AsyncBinaryWriter::write_slabs, this);
+}
+
+void AsyncBinaryWriter::finished_layers(int k0, int k1) {
+    // Slabs are encoded from first_pending to next_k, so layers must come in order.
+    assert(k0 == next_k && k1 > k0);
+    (void)k0;
+    next_k = k1;
+    if (next_k - first_pending >= slab_layers || next_k == nk) flush();
+}
+
+// Encodes the pending layers into the current slab and queues it for writing.
+void AsyncBinaryWriter::flush() {
+    Slab &slab = slabs[current];
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [&]{ return !slab.busy; });
+    }
+    slab.k0 = first_pending;
+    slab.k1 = next_k;
+    size_t layer = (size_t)ni*nj, first = slab.k0*layer, count = (slab.k1-slab.k0)*layer;
+    char *p = slab.data;
+    for (auto &src: sources) {
+        if (src.encoding == ENCODE_HALF || src.encoding == ENCODE_INT16) {
+            max_error = max(max_error, quantize_values((const float*)src.data + first, count, src.encoding,
+                                                       band, src.scale, (unsigned short*)p));
+        }
+        else if (src.name == "closest_tri" && tri_map) {
+            const int *t = (const int*)src.data + first;
+            int *out = (int*)p;
+            for (size_t c=0; c<count; ++c) out[c] = t[c] >= 0 ? (*tri_map)[t[c]] : t[c];
+        }
+        else {
+            std::memcpy(p, (const char*)src.data + first*encoding_size(src.encoding), count*encoding_size(src.encoding));
+        }
+        p += count*encoding_size(src.encoding);
+    }
+    std::unique_lock<std::mutex> guard(lock);
+    slab.busy = true;
+    queue.push_back(current);
+    changed.notify_all();
+    current = 1-current;
+    first_pending = next_k;
+}
+
+// The writer thread: writes queued slabs in order until finish().
+void AsyncBinaryWriter::write_slabs() {
+    while (true) {
+        int s;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            changed.wait(guard, [&]{ return done || !queue.empty(); });
+            if (queue.empty()) return;
+            s = queue.front();
+            queue.pop_front();
+        }
+        Slab &slab = slabs[s];
+        size_t layer = (size_t)ni*nj, first = slab.k0*layer, count = (slab.k1-slab.k0)*layer;
+        const char *p = slab.data;
+        for (auto &src: sources) {
+            size_t bytes = count*encoding_size(src.encoding), written = 0;
+            while (written < bytes) {
+                ssize_t w = pwrite(fd, p+written, bytes-written, src.offset + first*encoding_size(src.encoding) + written);
+                if (w <= 0) {
+                    std::cerr << "Failed to write " << output << ". Terminating.\n";
+                    exit(-1);
+                }
+                written += w;
+            }
+            p += bytes;
+        }
+        std::unique_lock<std::mutex> guard(lock);
+        slab.busy = false;
+        changed.notify_all();
+    }
+}
+
+float AsyncBinaryWriter::finish() {
+    if (!writer.joinable()) return max_error;
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        done = true;
+        changed.notify_all();
+    }
+    writer.join();
+    if (close(fd) != 0) {
+        std::cerr << "Failed to write " << output << ". Terminating.\n";
+        exit(-1);
+    }
+    return max_error;
+}
+
+// Reads all grid records of a binary SDF file.
+std::vector<SDFGrid> read_binary(std::string input) {
+    std::vector<SDFGrid> grids;
+    std::ifstream fid(input, std::ios::in|std::ios::binary);
+    char m[8];
+    if (!fid.read(m, sizeof(m)) || std::memcmp(m, magic, sizeof(m))) {
+        std::cerr << input << " is not a binary SDF file. Terminating.\n";
+        exit(-1);
+    }
+    int header[4];
+    while (fid.read((char*)header, sizeof(header))) {
+        SDFGrid g;
+        float geometry[4];
+        int num_channels;
+        fid.read((char*)geometry, sizeof(geometry));
+        fid.read((char*)&num_channels, sizeof(num_channels));
+        g.level = header[0];
+        g.ni = header[1]; g.nj = header[2]; g.nk = header[3];
+        g.origin = Vec3f(geometry[0], geometry[1], geometry[2]);
+        g.dx = geometry[3];
+        size_t n = (size_t)g.ni*g.nj*g.nk;
+        for (int c=0; c<num_channels; ++c) {
+            Channel ch;
+            char name[16];
+            int encoding;
+            fid.read(name, sizeof(name));
+            fid.read((char*)&encoding, sizeof(encoding));
+            fid.read((char*)&ch.scale, sizeof(ch.scale));
+            name[15] = '\0';
+            ch.name = name;
+            ch.encoding = (Encoding)encoding;
+            ch.storage.resize(n*encoding_size(ch.encoding));
+            fid.read(ch.storage.data(), ch.storage.size());
+            g.channels.push_back(ch);
+        }
+        if (!fid) {
+            std::cerr << "Truncated binary SDF file " << input << ". Terminating.\n";
+            exit(-1);
+        }
+        grids.push_back(g);
+    }
+    return grids;
+}
+
+// Maps a binary SDF file into memory and points the channels at it.
+std::vector<SDFGrid> map_binary(std::string input) {
+    std::vector<SDFGrid> grids;
+    int fd = open(input.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        std::cerr << "Failed to open " << input << ". Terminating.\n";
+        exit(-1);
+    }
+    size_t size = st.st_size;
+    void *map = size ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED || size < sizeof(magic) || std::memcmp(map, magic, sizeof(magic))) {
+        std::cerr << input << " is not a binary SDF file. Terminating.\n";
+        exit(-1);
+    }
+    const char *base = (const char*)map, *p = base + sizeof(magic), *end = base + size;
+    auto truncated = [&]() {
+        std::cerr << "Truncated binary SDF file " << input << ". Terminating.\n";
+        exit(-1);
+    };
+    // Sizes are compared with what is left rather than forming p+n, which a corrupt
+    // header could carry past the mapping (or wrap around).
+    auto check = [&](size_t n) {
+        if (n > (size_t)(end - p)) truncated();
+    };
+    auto take = [&](void *dst, size_t n) {
+        check(n);
+        std::memcpy(dst, p, n);
+        p += n;
+    };
+    while (p < end) {
+        SDFGrid g;
+        int header[4], num_channels;
+        float geometry[4];
+        take(header, sizeof(header));
+        take(geometry, sizeof(geometry));
+        take(&num_channels, sizeof(num_channels));
+        g.level = header[0];
+        g.ni = header[1]; g.nj = header[2]; g.nk = header[3];
+        g.origin = Vec3f(geometry[0], geometry[1], geometry[2]);
+        g.dx = geometry[3];
+        // A corrupt header is caught before the value count can overflow: no grid
+        // holds more values than there are bytes left.
+        size_t n = 0, left = end - p;
+        if (g.ni >= 0 && g.nj >= 0 && g.nk >= 0) {
+            n = g.ni;
+            if (g.nj && n > left/g.nj) truncated();
+            n *= g.nj;
+            if (g.nk && n > left/g.nk) truncated();
+            n *= g.nk;
+        }
+        else truncated();
+        for (int c=0; c<num_channels; ++c) {
+            Channel ch;
+            char name[16];
+            int encoding;
+            take(name, sizeof(name));
+            take(&encoding, sizeof(encoding));
+            take(&ch.scale, sizeof(ch.scale));
+            name[15] = '\0';
+            ch.name = name;
+            ch.encoding = (Encoding)encoding;
+            if (n > (size_t)(end - p)/encoding_size(ch.encoding)) truncated();
+            size_t bytes = n*encoding_size(ch.encoding);
+            ch.external = p;
+            p += bytes;
+            g.channels.push_back(ch);
+        }
+        grids.push_back(g);
+    }
+    return grids;
+}
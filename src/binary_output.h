@@ -0,0 +1,142 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "vec.h"
+#include "array3.h"
+#include "quantize.h"
+#include "makelevelset3.h"
+
+// Binary SDF file format (little endian):
+//   char  magic[8] = "SDFGRID1"
+// followed by one or more grid records:
+//   int   level, ni, nj, nk
+//   float origin[3], dx
+//   int   num_channels
+// and for each channel:
+//   char  name[16]
+//   int   encoding (see quantize.h)
+//   float scale
+//   ni*nj*nk values in ascending order of i, then j, then k.
+
+// One named array of grid values, kept in its stored encoding.  The values are
+// either owned (storage) or borrowed from an existing grid (external).
+struct Channel {
+    std::string name;
+    Encoding encoding;
+    float scale;
+    std::vector<char> storage;
+    const char *external;
+    Channel() : encoding(ENCODE_FLOAT32), scale(1), external(nullptr) {}
+    const char *data() const { return external ? external : storage.data(); }
+    // Decodes value n (linear index) on the fly.
+    float operator[](size_t n) const {
+        return decode_value(data(), n, encoding, scale);
+    }
+};
+
+// One grid record of a binary SDF file.
+struct SDFGrid {
+    int level;
+    int ni, nj, nk;
+    Vec3f origin;
+    float dx;
+    std::vector<Channel> channels;
+    // Returns the channel with the given name, or nullptr.
+    const Channel *find(std::string name) const;
+};
+
+// Makes a channel referring to the grid in its native encoding (no copy is made,
+// so the grid must outlive the channel).
+Channel make_channel(std::string name, const Array3f &grid);
+Channel make_channel(std::string name, const Array3i &grid);
+// Makes a channel referring to 16-bit data produced by quantize().
+Channel make_channel(std::string name, const Array3us &grid, Encoding e, float scale);
+
+// Writes grids as records of a binary SDF file.
+void write_as_binary(std::string output, const std::vector<SDFGrid> &grids);
+// Writes consecutive slabs along k of one grid (same ni, nj, origin x/y, dx and
+// channels, in order of increasing k) as a single grid record.  Channel data is
+// copied slab by slab, so mapped slabs are streamed rather than loaded.
+void write_slabs_as_binary(std::string output, const std::vector<SDFGrid> &slabs);
+// Writes one grid record whose channels (name, encoding and scale set, no data)
+// are generated slab by slab along k: fill(c, k0, k1, out) encodes layers
+// k0..k1-1 of channel c into out.  Only one slab of slab_layers is held at a time.
+void write_generated_as_binary(std::string output, const SDFGrid &g, int slab_layers,
+                               const std::function<void(int, int, int, char*)> &fill);
+// Makes the grid record written by write_as_binary below, at the given level.
+// Quantized phi values are owned by the record; the other channels refer to the
+// given grids.  max_error is set as write_as_binary returns it.
+SDFGrid make_level_set_grid(const Array3f &phi, const Vec3f &origin, float dx, Encoding e,
+                            float band, const Array3i *closest_tri,
+                            const LevelSetChannels *channels, float &max_error, int level=0);
+// Writes a phi grid in the given precision, plus the closest triangle indices and
+// extra channels when given.  Returns the largest quantization error within band
+// (zero for float).
+float write_as_binary(std::string output, const Array3f &phi, const Vec3f &origin, float dx,
+                      Encoding e=ENCODE_FLOAT32, float band=0,
+                      const Array3i *closest_tri=nullptr,
+                      const LevelSetChannels *channels=nullptr);
+// Writes the grids of make_level_set3 as a binary SDF file (channels as for
+// write_as_binary) while the sign pass is still running: finished layers are
+// encoded into one of two aligned buffers, which a background thread writes out
+// while the other fills, so the output overlaps the computation.
+class AsyncBinaryWriter : public LevelSetSink {
+public:
+    // If tri_map is given, closest_tri t is written as (*tri_map)[t].
+    AsyncBinaryWriter(std::string output, const Vec3f &origin, float dx,
+                      Encoding e=ENCODE_FLOAT32, float band=0, bool write_tri=false,
+                      const std::vector<int> *tri_map=nullptr);
+    ~AsyncBinaryWriter();
+    void begin(const Array3f &phi, const Array3i &closest_tri, const LevelSetChannels *channels);
+    void finished_layers(int k0, int k1);
+    // Waits for the last write and returns the largest quantization error within
+    // band (zero for float).
+    float finish();
+
+private:
+    // One grid channel and where its values go in the file.
+    struct Source {
+        std::string name;
+        const void *data;  // the grid in memory
+        Encoding encoding; // as stored
+        float scale;
+        size_t offset;     // of the first value
+    };
+    // Encoded layers k0..k1-1 of every channel, one after another.
+    struct Slab {
+        char *data;
+        int k0, k1;
+        bool busy;
+    };
+    void flush();
+    void write_slabs();
+
+    std::string output;
+    Vec3f origin;
+    float dx, band, scale, max_error;
+    Encoding encoding;
+    bool write_tri;
+    const std::vector<int> *tri_map;
+    int ni, nj, nk, slab_layers, next_k, first_pending;
+    int fd;
+    std::vector<Source> sources;
+    Slab slabs[2];
+    int current;
+    std::deque<int> queue;
+    bool done;
+    std::mutex lock;
+    std::condition_variable changed;
+    std::thread writer;
+};
+
+// Reads all grid records of a binary SDF file.
+std::vector<SDFGrid> read_binary(std::string input);
+// As read_binary, but maps the file into memory read-only instead of copying it, so
+// the channels refer to the page cache shared by every process mapping the file.
+// The mapping stays valid for the life of the process.
+std::vector<SDFGrid> map_binary(std::string input);
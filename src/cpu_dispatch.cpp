@@ -0,0 +1,39 @@
+#include "cpu_dispatch.h"
+
+// Same order of preference as the loader's resolver for target_clones.
+const char *cpu_dispatch_name() {
+#ifdef HAVE_MULTIVERSION
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return "avx512f";
+    if (__builtin_cpu_supports("avx2"))    return "avx2";
+    if (__builtin_cpu_supports("sse4.2"))  return "sse4.2";
+#endif
+    return "generic";
+}
+
+bool cpu_has_f16c() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    static bool supported = __builtin_cpu_supports("f16c") && __builtin_cpu_supports("avx");
+    return supported;
+#else
+    return false;
+#endif
+}
+
+bool cpu_has_avx2() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    static bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+#else
+    return false;
+#endif
+}
+
+bool cpu_has_fma() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    static bool supported = __builtin_cpu_supports("fma");
+    return supported;
+#else
+    return false;
+#endif
+}
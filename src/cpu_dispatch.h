@@ -0,0 +1,23 @@
+#pragma once
+
+// Hot loops marked MULTIVERSION are compiled once per instruction set below (GCC
+// function multiversioning), and the dynamic loader binds each to the best version
+// the running CPU supports, so one portable binary still uses AVX where available.
+// Contracting into FMA is disabled so that every version rounds alike and results
+// do not depend on the machine that computed them.
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && __GNUC__ >= 6
+#define MULTIVERSION __attribute__((target_clones("avx512f", "avx2", "sse4.2", "default"), \
+                                    optimize("fp-contract=off")))
+#define HAVE_MULTIVERSION
+#else
+#define MULTIVERSION
+#endif
+
+// The instruction set of the MULTIVERSION kernels selected on this CPU: "avx512f",
+// "avx2", "sse4.2" or "generic".
+const char *cpu_dispatch_name();
+
+// Whether the CPU supports F16C half precision conversions, AVX2, and FMA.
+bool cpu_has_f16c();
+bool cpu_has_avx2();
+bool cpu_has_fma();
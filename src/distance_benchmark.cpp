@@ -0,0 +1,130 @@
+#include "distance_benchmark.h"
+#include "makelevelset3.h"
+#include "mesh_query.h"
+#include <chrono>
+#include <iostream>
+
+using std::cout;
+
+// Seconds since start.
+static double elapsed(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static float random_unit(unsigned int seed) {
+    return randhashf(seed, -1, 1);
+}
+
+static Vec3f random_point(unsigned int seed, float scale) {
+    return scale*Vec3f(random_unit(3*seed), random_unit(3*seed+1), random_unit(3*seed+2));
+}
+
+// Runs f(q) for q in [0, n) repeats times and prints the time per call.
+template<class F>
+static void time_calls(const char *name, unsigned int n, int repeats, F f) {
+    double sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int r=0; r<repeats; ++r) {
+        for (unsigned int q=0; q<n; ++q) sum += f(q);
+    }
+    double seconds = elapsed(start);
+    cout << "  " << name << ": " << 1e9*seconds/((double)n*repeats) << " ns/call (checksum "
+         << sum << ")\n";
+}
+
+void run_distance_benchmark(unsigned int n) {
+    // Triangles about a unit across with points scattered around them, so that all
+    // cases (face, edge and vertex closest) occur.
+    std::vector<Vec3f> a(n), b(n), c(n), p(n);
+    std::vector<Vec3d> ad(n), bd(n);
+    for (unsigned int q=0; q<n; ++q) {
+        a[q] = random_point(4*q, 2);
+        b[q] = a[q] + random_point(4*q+1, 1);
+        c[q] = a[q] + random_point(4*q+2, 1);
+        p[q] = random_point(4*q+3, 3);
+        ad[q] = Vec3d(a[q]);
+        bd[q] = Vec3d(p[q]);
+    }
+    int repeats = max(1, (int)(20000000/max(n, 1u)));
+    cout << "Distance kernels on " << n << " triangles, " << repeats << " passes:\n";
+    time_calls("point_triangle_distance", n, repeats, [&](unsigned int q) {
+        return point_triangle_distance(p[q], a[q], b[q], c[q]);
+    });
+    // Rows of 16 points 0.1 apart along x, as rasterize_band evaluates them.
+    const int row = 16;
+    float d[row];
+    time_calls("point_triangle_distance x16", n, max(1, repeats/row), [&](unsigned int q) {
+        float sum = 0;
+        for (int i=0; i<row; ++i) {
+            sum += point_triangle_distance(Vec3f(i*0.1f + p[q][0], p[q][1], p[q][2]), a[q], b[q], c[q]);
+        }
+        return sum;
+    });
+    time_calls("point_triangle_distance_row (16)", n, max(1, repeats/row), [&](unsigned int q) {
+        point_triangle_distance_row(p[q][0], 0.1f, 0, row-1, p[q][1], p[q][2], a[q], b[q], c[q], d);
+        float sum = 0;
+        for (int i=0; i<row; ++i) sum += d[i];
+        return sum;
+    });
+    time_calls("point_triangle_closest", n, repeats, [&](unsigned int q) {
+        return point_triangle_closest(p[q], a[q], b[q], c[q])[0];
+    });
+    cout << "Vec operations:\n";
+    time_calls("Vec3f dist", n, repeats, [&](unsigned int q) { return dist(p[q], a[q]); });
+    time_calls("Vec3f mag2(a-b)", n, repeats, [&](unsigned int q) { return mag2(p[q] - a[q]); });
+    time_calls("Vec3f dot", n, repeats, [&](unsigned int q) { return dot(b[q] - a[q], p[q] - a[q]); });
+    time_calls("Vec3d dot(a-b)", n, repeats, [&](unsigned int q) {
+        Vec3d d = bd[q] - ad[q];
+        return dot(d, ad[q]);
+    });
+    time_calls("Vec3d mag2(a-b)", n, repeats, [&](unsigned int q) { return mag2(ad[q] - bd[q]); });
+}
+
+bool run_engine_check(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x, float dx,
+                      int padding) {
+    Vec3f lo = x[0], hi = x[0];
+    for (auto &v: x) update_minmax(v, lo, hi);
+    Vec3f unit(1, 1, 1);
+    padding = max(padding, 1);
+    lo -= padding*dx*unit;
+    hi += padding*dx*unit;
+    Vec3ui sizes((hi - lo)/dx);
+    size_t num_nodes = (size_t)sizes[0]*sizes[1]*sizes[2];
+    cout << "Checking engines on " << sizes << " nodes against exact distances.\n";
+
+    TriangleBVH bvh(tri, x);
+    std::vector<float> exact(num_nodes);
+    #pragma omp parallel for schedule(dynamic)
+    for (int k=0; k<(int)sizes[2]; ++k) {
+        int closest = -1;
+        for (unsigned j=0; j<sizes[1]; ++j) for (unsigned i=0; i<sizes[0]; ++i) {
+            size_t n = i + sizes[0]*(j + (size_t)sizes[1]*k);
+            exact[n] = bvh.distance(lo + dx*Vec3f(i, j, k), closest);
+        }
+    }
+
+    const char *names[] = {"sweep", "march", "edt"};
+    LevelSetEngine engines[] = {ENGINE_SWEEP, ENGINE_MARCH, ENGINE_EDT};
+    float sweep_error = 0;
+    bool passed = true;
+    for (int e=0; e<3; ++e) {
+        LevelSetOptions opts;
+        opts.engine = engines[e];
+        // As main runs the edt engine.
+        if (opts.engine == ENGINE_EDT) opts.exact_band = 2;
+        Array3f phi;
+        Array3i closest_tri;
+        auto start = std::chrono::steady_clock::now();
+        make_level_set3(tri, x, lo, dx, sizes[0], sizes[1], sizes[2], phi, closest_tri, opts);
+        double seconds = elapsed(start);
+        float error = 0;
+        for (size_t n=0; n<num_nodes; ++n) error = max(error, std::fabs(std::fabs(phi.a[n]) - exact[n]));
+        if (e == 0) sweep_error = error;
+        float tolerance = max(2*sweep_error, 0.05f*dx);
+        bool ok = e == 0 || error <= tolerance;
+        cout << "  " << names[e] << ": " << seconds << " s, max error " << error << " ("
+             << error/dx << " dx)" << (ok ? "" : ", FAILED") << "\n";
+        passed = passed && ok;
+    }
+    return passed;
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <vector>
+#include "vec.h"
+
+// Times the point-triangle distance kernels of makelevelset3 and the Vec3f/Vec3d
+// operations they are built from (difference, dot, mag2, dist) on n random
+// triangles and points, reporting nanoseconds per call and a checksum that must
+// not change between builds.
+void run_distance_benchmark(unsigned int n);
+
+// Computes the field of tri/x on a grid with spacing dx and padding cells around the
+// mesh with each engine (sweep, march, edt) and compares |phi| at every node with
+// the exact distance from a TriangleBVH.  Reports the largest error of each engine
+// and returns false if march or edt is off by more than twice the sweep engine (or
+// 0.05dx if that is larger).
+bool run_engine_check(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x, float dx,
+                      int padding);
@@ -0,0 +1,96 @@
+#include "grid_memory.h"
+#include <fstream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <vector>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+static const size_t huge_page = 2 << 20;
+
+// Totals over the grids recorded so far.
+static size_t grid_count = 0, grid_bytes = 0, grid_written = 0;
+static double grid_seconds = 0;
+static std::map<int, size_t> pages_on_node;
+
+void *allocate_grid_memory(size_t bytes) {
+    void *data = nullptr;
+    if (bytes < huge_page) {
+        if (posix_memalign(&data, 64, bytes ? bytes : 1) != 0) throw std::bad_alloc();
+        return data;
+    }
+    size_t rounded = (bytes + huge_page - 1)/huge_page*huge_page;
+    if (posix_memalign(&data, huge_page, rounded) != 0) throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+    // Only a hint: without THP support the grid simply uses normal pages.
+    madvise(data, rounded, MADV_HUGEPAGE);
+#endif
+    return data;
+}
+
+// Adds the NUMA nodes of up to 256 pages spread over [data, data+bytes) to
+// pages_on_node.  move_pages with no target nodes only reports where pages are.
+static void sample_page_nodes(const void *data, size_t bytes) {
+#if defined(__linux__) && defined(SYS_move_pages)
+    const size_t page = sysconf(_SC_PAGESIZE), samples = 256;
+    size_t num_pages = (bytes + page - 1)/page;
+    size_t count = std::min(num_pages, samples);
+    std::vector<void*> pages(count);
+    std::vector<int> status(count);
+    for (size_t s=0; s<count; ++s) {
+        pages[s] = (char*)data + num_pages*s/count*page;
+    }
+    if (syscall(SYS_move_pages, 0, count, pages.data(), nullptr, status.data(), 0) != 0) return;
+    for (int node: status) {
+        if (node >= 0) ++pages_on_node[node];
+    }
+#endif
+}
+
+void record_grid_allocation(const void *data, size_t bytes, size_t written, double seconds) {
+    ++grid_count;
+    grid_bytes += bytes;
+    grid_written += written;
+    grid_seconds += seconds;
+    sample_page_nodes(data, bytes);
+}
+
+// AnonHugePages of the whole process in bytes, or -1 if the kernel does not say.
+static long long process_huge_page_bytes() {
+    std::ifstream in("/proc/self/smaps_rollup");
+    std::string key;
+    long long kb;
+    while (in >> key) {
+        if (key == "AnonHugePages:" && in >> kb) return kb*1024;
+        in.ignore(1 << 16, '\n');
+    }
+    return -1;
+}
+
+std::string grid_memory_summary() {
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    std::ostringstream out;
+    out << "Grid memory: " << grid_count << " grids, " << (grid_bytes >> 20) << " MB, of which "
+        << (grid_written >> 20) << " MB initialized up front by " << threads << " threads in "
+        << grid_seconds << " s";
+    long long huge = process_huge_page_bytes();
+    if (huge >= 0) out << "; " << (huge >> 20) << " MB of the process in huge pages";
+    size_t sampled = 0;
+    for (auto &n: pages_on_node) sampled += n.second;
+    if (sampled) {
+        out << "; sampled pages by NUMA node:";
+        for (auto &n: pages_on_node) out << " " << n.first << ": " << 100*n.second/sampled << "%";
+    }
+    out << ".";
+    return out.str();
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include "array3.h"
+
+// Allocation policy for the full-size grids (phi, closest_tri, intersection counts
+// and channels).  Their storage is aligned to 2 MB and advised as transparent huge
+// pages, and is first touched in parallel with layers k split statically between
+// the threads.  On a NUMA machine the pages are then spread over the nodes of the
+// threads, in runs of layers, instead of all landing on the node of the main
+// thread.  This is not locality: the passes that use the grids afterwards do not
+// follow that split (the sweeps and the sign pass are serial, and rasterization
+// hands out blocks dynamically), so it balances bandwidth rather than keeping
+// accesses local.  grid_memory_summary reports the placement actually obtained.
+
+// Storage of at least bytes, released with std::free like any Array1 data.  Throws
+// std::bad_alloc if there is none.
+void *allocate_grid_memory(size_t bytes);
+
+// Adds a grid to the statistics reported by grid_memory_summary, of which written
+// bytes were set up front (the rest is left for its first user).
+void record_grid_allocation(const void *data, size_t bytes, size_t written, double seconds);
+
+// One line on the grids allocated so far: their size, how much of it was written
+// up front and in what time, how much is in huge pages, and the NUMA nodes of a
+// sample of their pages.
+std::string grid_memory_summary();
+
+// Resizes a to ni x nj x nk, allocating with allocate_grid_memory if the current
+// storage is too small, and calls init(first, last) on the layers of values in
+// parallel.
+template<class T, class F>
+void allocate_grid_layers(Array3<T, Array1<T> > &a, int ni, int nj, int nk, size_t written, F init) {
+    auto start = std::chrono::steady_clock::now();
+    size_t layer = (size_t)ni*nj, n = layer*nk;
+    if (a.a.max_n < n) {
+        T *data = (T*)allocate_grid_memory(n*sizeof(T));
+        std::free(a.a.data);
+        a.a.data = data;
+        a.a.max_n = n;
+    }
+    a.a.n = n;
+    a.ni = ni;
+    a.nj = nj;
+    a.nk = nk;
+    T *data = a.a.data;
+    #pragma omp parallel for schedule(static)
+    for (int k=0; k<nk; ++k) {
+        init(data + k*layer, data + (k+1)*layer);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    record_grid_allocation(data, n*sizeof(T), written, seconds);
+}
+
+// Resizes a to ni x nj x nk and sets every value.
+template<class T>
+void allocate_grid(Array3<T, Array1<T> > &a, int ni, int nj, int nk, const T &value) {
+    allocate_grid_layers(a, ni, nj, nk, (size_t)ni*nj*nk*sizeof(T), [&](T *first, T *last) {
+        std::fill(first, last, value);
+    });
+}
+
+// Resizes a to ni x nj x nk, leaving the values unset: only one value per 4 KB is
+// written, to place the pages as allocate_grid would.  The caller initializes
+// the values before reading them.
+template<class T>
+void allocate_grid_pages(Array3<T, Array1<T> > &a, int ni, int nj, int nk, const T &value) {
+    const size_t stride = 4096/sizeof(T);
+    allocate_grid_layers(a, ni, nj, nk, 0, [&](T *first, T *last) {
+        for (T *v=first; v<last; v+=stride) *v = value;
+    });
+}
+
+// Resizes a to ni x nj x nk of zeros.  New storage comes zeroed from calloc, which
+// for large grids maps pages only as they are written, so values never written
+// cost no stores at all (nor NUMA placement: pages go to the node of their first
+// writer).  Storage that is reused is cleared in parallel.
+template<class T>
+void allocate_zeroed_grid(Array3<T, Array1<T> > &a, int ni, int nj, int nk) {
+    size_t n = (size_t)ni*nj*nk;
+    if (a.a.max_n >= n) {
+        allocate_grid(a, ni, nj, nk, T(0));
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    Array1<T> zeros(n);
+    a.a.swap(zeros);
+    a.ni = ni;
+    a.nj = nj;
+    a.nk = nk;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    record_grid_allocation(a.a.data, n*sizeof(T), 0, seconds);
+}
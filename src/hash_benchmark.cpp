@@ -0,0 +1,128 @@
+#include "hash_benchmark.h"
+#include "hashgrid.h"
+#include "open_hashtable.h"
+#include <chrono>
+#include <iostream>
+
+using std::cout;
+
+// Results of one table's run, compared between tables.
+struct HashBenchResult {
+    double insert_time, lookup_time, build_time, query_time;
+    long long lookup_hits, grid_sum, grid_count;
+};
+
+// Seconds since start.
+static double elapsed(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// A random cell in a cube of the given side.
+static Vec3i random_cell(unsigned int seed, int side) {
+    return Vec3i(randhash(3*seed) % side, randhash(3*seed+1) % side, randhash(3*seed+2) % side);
+}
+
+// Side of the cube of cells the keys are drawn from, about 8 cells per key.
+static int key_range(unsigned int n) {
+    return 2*(int)std::pow((double)n, 1/3.) + 1;
+}
+
+// n/8 boxes up to 3 cells across, as when binning triangles, and as many 2x2x2 query
+// boxes.
+static void random_boxes(unsigned int n, std::vector<Vec3d> &lo, std::vector<Vec3d> &hi,
+                         std::vector<Vec3d> &query_lo) {
+    int side = key_range(n);
+    lo.resize(n/8); hi.resize(n/8); query_lo.resize(n/8);
+    for (unsigned int q=0; q<n/8; ++q) {
+        lo[q] = Vec3d(random_cell(q, side));
+        hi[q] = lo[q] + Vec3d(random_cell(n+q, 3));
+        query_lo[q] = Vec3d(random_cell(2*n+q, side));
+    }
+}
+
+// Times box queries against a grid with HashGrid3's find_box.
+template<class Grid>
+static void query_grid(const Grid &grid, const std::vector<Vec3d> &query_lo, HashBenchResult &r) {
+    std::vector<int> found;
+    r.grid_sum = r.grid_count = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (auto &lo: query_lo) {
+        grid.find_box(lo, lo + Vec3d(1, 1, 1), found);
+        r.grid_count += found.size();
+        for (auto d: found) r.grid_sum += d;
+    }
+    r.query_time = elapsed(start);
+}
+
+template<class Table, class Grid>
+static HashBenchResult run_tables(unsigned int n) {
+    HashBenchResult r;
+    int side = key_range(n);
+    // Every other lookup uses a key outside the inserted ones.
+    std::vector<Vec3i> keys(n), lookups(n);
+    for (unsigned int q=0; q<n; ++q) {
+        keys[q] = random_cell(q, side);
+        lookups[q] = q%2 ? keys[q] : keys[q] + Vec3i(side, 0, 0);
+    }
+
+    Table table;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int q=0; q<n; ++q) table.add(keys[q], q);
+    r.insert_time = elapsed(start);
+
+    // Keys can repeat and the tables return different entries for them, so only
+    // hits are compared.
+    r.lookup_hits = 0;
+    start = std::chrono::steady_clock::now();
+    for (unsigned int q=0; q<n; ++q) {
+        int data;
+        if (table.get_entry(lookups[q], data)) ++r.lookup_hits;
+    }
+    r.lookup_time = elapsed(start);
+
+    std::vector<Vec3d> lo, hi, query_lo;
+    random_boxes(n, lo, hi, query_lo);
+    Grid grid(1.0, 64);
+    start = std::chrono::steady_clock::now();
+    for (size_t b=0; b<lo.size(); ++b) grid.add_box(lo[b], hi[b], b);
+    r.build_time = elapsed(start);
+    query_grid(grid, query_lo, r);
+    return r;
+}
+
+// The same boxes and queries with a CSRHashGrid3 built in bulk.
+static HashBenchResult run_csr(unsigned int n) {
+    HashBenchResult r;
+    std::vector<Vec3d> lo, hi, query_lo;
+    random_boxes(n, lo, hi, query_lo);
+    std::vector<int> ids(lo.size());
+    for (size_t b=0; b<ids.size(); ++b) ids[b] = b;
+    CSRHashGrid3<int> grid(1.0);
+    auto start = std::chrono::steady_clock::now();
+    grid.build(lo, hi, ids);
+    r.build_time = elapsed(start);
+    query_grid(grid, query_lo, r);
+    return r;
+}
+
+void run_hash_benchmark(unsigned int n) {
+    auto chained = run_tables<HashTable<Vec3i,int>, HashGrid3<int> >(n);
+    auto open = run_tables<OpenHashTable<Vec3i,int>,
+                           HashGrid3<int, OpenHashTable<Vec3i,int> > >(n);
+    auto csr = run_csr(n);
+    cout << "Insert " << n << " keys: HashTable " << chained.insert_time
+         << " s, OpenHashTable " << open.insert_time << " s.\n";
+    cout << "Look up " << n << " keys: HashTable " << chained.lookup_time
+         << " s, OpenHashTable " << open.lookup_time << " s.\n";
+    cout << "Add " << n/8 << " boxes to HashGrid3: HashTable " << chained.build_time
+         << " s, OpenHashTable " << open.build_time << " s, CSRHashGrid3 bulk build "
+         << csr.build_time << " s.\n";
+    cout << "Query " << n/8 << " boxes (" << open.grid_count << " entries found): HashTable "
+         << chained.query_time << " s, OpenHashTable " << open.query_time
+         << " s, CSRHashGrid3 " << csr.query_time << " s.\n";
+    if (chained.lookup_hits != open.lookup_hits || chained.grid_sum != open.grid_sum
+            || chained.grid_count != open.grid_count
+            || chained.grid_sum != csr.grid_sum || chained.grid_count != csr.grid_count) {
+        cout << "Error: the tables returned different results.\n";
+    }
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+// Times HashTable against OpenHashTable on n random Vec3i keys: inserts, lookups
+// (half of them misses), and HashGrid3 box insertion plus multi-value box queries,
+// which are also timed for a bulk built CSRHashGrid3.  Reports a mismatch if the
+// tables ever disagree.
+void run_hash_benchmark(unsigned int n);
@@ -3,14 +3,19 @@
 
 #include "hashtable.h"
 #include "vec.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 //========================================================= first do 2D ============================
 
-template<class DataType>
+// Table can be any map from cell to DataType with HashTable's interface, such as
+// OpenHashTable<Vec2i,DataType> from open_hashtable.h.
+template<class DataType, class Table=HashTable<Vec2i,DataType> >
 struct HashGrid2
 {
    double dx, overdx; // side-length of a grid cell and its reciprocal
-   HashTable<Vec2i,DataType> grid;
+   Table grid;
 
    explicit HashGrid2(double dx_=1, int expected_size=512)
       : dx(dx_), overdx(1/dx_), grid(expected_size)
@@ -71,11 +76,11 @@ struct HashGrid2
 
 //==================================== and now in 3D =================================================
 
-template<class DataType>
+template<class DataType, class Table=HashTable<Vec3i,DataType> >
 struct HashGrid3
 {
    double dx, overdx; // side-length of a grid cell and its reciprocal
-   HashTable<Vec3i,DataType> grid;
+   Table grid;
 
    explicit HashGrid3(double dx_=1, int expected_size=512)
       : dx(dx_), overdx(1/dx_), grid(expected_size)
@@ -134,4 +139,205 @@ struct HashGrid3
    }
 };
 
+//==================================== frozen 3D grid ================================================
+
+// Stable LSD radix sort of values by keys (both reordered), 11 bits per pass over the
+// bits needed for max_key.  Each pass histograms and scatters in parallel, with one
+// contiguous chunk of the input per thread.
+template<class Value>
+void radix_sort(std::vector<unsigned long long> &keys, std::vector<Value> &values, unsigned long long max_key)
+{
+   const int bits=11, buckets=1<<bits;
+   size_t n=keys.size();
+   std::vector<unsigned long long> keys2(n);
+   std::vector<Value> values2(n);
+   std::vector<size_t> count;
+   for(int shift=0; shift<64 && (max_key>>shift)!=0; shift+=bits){
+      #pragma omp parallel
+      {
+#ifdef _OPENMP
+         int num_threads=omp_get_num_threads(), thread=omp_get_thread_num();
+#else
+         int num_threads=1, thread=0;
+#endif
+         #pragma omp single
+         count.assign((size_t)num_threads*buckets, 0);
+         size_t first=n*thread/num_threads, last=n*(thread+1)/num_threads;
+         size_t *c=&count[(size_t)thread*buckets];
+         for(size_t i=first; i<last; ++i)
+            ++c[(keys[i]>>shift)&(buckets-1)];
+         #pragma omp barrier
+         #pragma omp single
+         {
+            // bucket-major, thread-minor offsets keep the sort stable
+            size_t sum=0;
+            for(int b=0; b<buckets; ++b) for(int t=0; t<num_threads; ++t){
+               size_t m=count[(size_t)t*buckets+b];
+               count[(size_t)t*buckets+b]=sum;
+               sum+=m;
+            }
+         }
+         for(size_t i=first; i<last; ++i){
+            size_t d=c[(keys[i]>>shift)&(buckets-1)]++;
+            keys2[d]=keys[i];
+            values2[d]=values[i];
+         }
+      }
+      keys.swap(keys2);
+      values.swap(values2);
+   }
+}
+
+// An immutable alternative to HashGrid3 built from all its boxes at once.  The
+// (cell, datum) pairs are generated in parallel and radix sorted by cell, so the data
+// of each occupied cell end up contiguous (compressed sparse rows) and in the order
+// the boxes were given.  Queries hand out pointer ranges instead of appending to a
+// vector.  Cells are found through a linear probing table of indices into cells, with
+// a parallel array of 7-bit hash tags (as in OpenHashTable) so that lookups of empty
+// cells mostly touch only the small tag array.
+template<class DataType>
+struct CSRHashGrid3
+{
+   double dx, overdx; // side-length of a grid cell and its reciprocal
+   std::vector<Vec3i> cells;                // occupied cells, ordered by k, then j, then i
+   std::vector<unsigned int> offsets;       // cells[c] holds data[offsets[c]] to data[offsets[c+1]-1]
+   std::vector<DataType> data;
+   std::vector<unsigned int> index;         // c for each cell, at or after its hash's slot
+   std::vector<unsigned char> index_tag;    // tag of index[s], or EMPTY
+   unsigned int index_bits;                 // index has 1<<index_bits slots
+   enum { EMPTY=0x80 };
+
+   explicit CSRHashGrid3(double dx_=1)
+      : dx(dx_), overdx(1/dx_), index(1), index_tag(1, (unsigned char)EMPTY), index_bits(0)
+   {}
+
+   // replaces the contents with datum[b] in every cell of box b, as add_box would
+   void build(const std::vector<Vec3d> &xmin, const std::vector<Vec3d> &xmax, const std::vector<DataType> &datum)
+   {
+      std::vector<Vec3i> imin(xmin.size()), imax(xmax.size());
+      for(size_t b=0; b<xmin.size(); ++b){
+         imin[b]=round(xmin[b]*overdx);
+         imax[b]=round(xmax[b]*overdx);
+      }
+      build_cells(imin, imax, datum);
+   }
+
+   // as above with boxes given directly as inclusive cell index ranges
+   void build_cells(const std::vector<Vec3i> &imin, const std::vector<Vec3i> &imax, const std::vector<DataType> &datum)
+   {
+      size_t n=imin.size();
+      cells.clear(); offsets.assign(1, 0); data.clear(); index.assign(1, 0); index_tag.assign(1, (unsigned char)EMPTY); index_bits=0;
+      if(n==0) return;
+      // where each box's pairs start, and the range of cells touched
+      std::vector<size_t> start(n+1, 0);
+      Vec3i lo=imin[0], hi=imax[0];
+      for(size_t b=0; b<n; ++b){
+         Vec3i e=imax[b]-imin[b]+Vec3i(1,1,1);
+         start[b+1]=start[b]+(e[0]>0 && e[1]>0 && e[2]>0 ? (size_t)e[0]*e[1]*e[2] : 0);
+         update_minmax(imin[b], lo, hi);
+         update_minmax(imax[b], lo, hi);
+      }
+      unsigned long long ni=hi[0]-lo[0]+1, nj=hi[1]-lo[1]+1, nk=hi[2]-lo[2]+1;
+      std::vector<unsigned long long> keys(start[n]);
+      data.resize(start[n]);
+      #pragma omp parallel for schedule(dynamic, 256)
+      for(long long b=0; b<(long long)n; ++b){
+         size_t p=start[b];
+         for(int k=imin[b][2]; k<=imax[b][2]; ++k) for(int j=imin[b][1]; j<=imax[b][1]; ++j) for(int i=imin[b][0]; i<=imax[b][0]; ++i){
+            keys[p]=(i-lo[0])+ni*((j-lo[1])+nj*(k-lo[2]));
+            data[p++]=datum[b];
+         }
+      }
+      radix_sort(keys, data, ni*nj*nk-1);
+      // runs of equal keys are the cells
+      offsets.clear();
+      for(size_t p=0; p<keys.size(); ++p){
+         if(p>0 && keys[p]==keys[p-1]) continue;
+         unsigned long long key=keys[p];
+         cells.push_back(lo+Vec3i(key%ni, key/ni%nj, key/(ni*nj)));
+         offsets.push_back(p);
+      }
+      offsets.push_back(keys.size());
+      // at most half full, with linear probing from the high bits of the hash
+      while((1u<<index_bits) < 2*cells.size())
+         ++index_bits;
+      index.resize(1u<<index_bits);
+      index_tag.assign(1u<<index_bits, (unsigned char)EMPTY);
+      for(unsigned int c=0; c<cells.size(); ++c){
+         unsigned int h=hash(cells[c]), s=first_index(h);
+         while(index_tag[s]!=EMPTY)
+            s=(s+1)&(index.size()-1);
+         index[s]=c;
+         index_tag[s]=(h^(h>>15))&0x7f;
+      }
+   }
+
+   unsigned int size(void) const
+   { return data.size(); }
+
+   unsigned int num_cells(void) const
+   { return cells.size(); }
+
+   // the data of cell c (an index into cells) are [cell_begin(c), cell_end(c))
+   const DataType *cell_begin(unsigned int c) const
+   { return &data[0]+offsets[c]; }
+
+   const DataType *cell_end(unsigned int c) const
+   { return &data[0]+offsets[c+1]; }
+
+   unsigned int first_index(unsigned int h) const
+   { return index_bits ? h>>(32-index_bits) : 0; }
+
+   // finds the data of the cell with the given indices
+   bool find_cell(const Vec3i &cell, const DataType *&first, const DataType *&last) const
+   {
+      unsigned int h=hash(cell);
+      unsigned char tag=(h^(h>>15))&0x7f;
+      for(unsigned int s=first_index(h); index_tag[s]!=EMPTY; s=(s+1)&(index.size()-1)){
+         unsigned int c=index[s];
+         if(index_tag[s]==tag && cells[c]==cell){
+            first=cell_begin(c);
+            last=cell_end(c);
+            return true;
+         }
+      }
+      return false;
+   }
+
+   bool find_first_point(const Vec3d &x, DataType &datum) const
+   {
+      const DataType *first, *last;
+      if(!find_cell(round(x*overdx), first, last)) return false;
+      datum=*first;
+      return true;
+   }
+
+   bool find_point(const Vec3d &x, std::vector<DataType> &data_list) const
+   {
+      data_list.resize(0);
+      const DataType *first, *last;
+      if(find_cell(round(x*overdx), first, last))
+         data_list.assign(first, last);
+      return data_list.size()>0;
+   }
+
+   // calls f(datum) for every datum in every cell of the box, without allocating
+   template<class F>
+   void for_each_in_box(const Vec3d &xmin, const Vec3d &xmax, F f) const
+   {
+      Vec3i imin=round(xmin*overdx), imax=round(xmax*overdx);
+      const DataType *first, *last;
+      for(int k=imin[2]; k<=imax[2]; ++k) for(int j=imin[1]; j<=imax[1]; ++j) for(int i=imin[0]; i<=imax[0]; ++i)
+         if(find_cell(Vec3i(i,j,k), first, last))
+            for(; first!=last; ++first) f(*first);
+   }
+
+   bool find_box(const Vec3d &xmin, const Vec3d &xmax, std::vector<DataType> &data_list) const
+   {
+      data_list.resize(0);
+      for_each_in_box(xmin, xmax, [&](const DataType &d){ data_list.push_back(d); });
+      return data_list.size()>0;
+   }
+};
+
 #endif
@@ -92,6 +92,7 @@ struct HashTable
             *p_i=pool[i].next; // make list skip over this entry
             pool[i].next=free_list; // and put it on the front of the free list
             free_list=i;
+            --num_entries;
             return; // and we're done
          }
          p_i=&pool[i].next;
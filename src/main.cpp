@@ -6,11 +6,27 @@
 #include "readers.h"
 #include "string_tools.h"
 #include "vtk_output.h"
+#include "binary_output.h"
 #include "makelevelset3.h"
+#include "sequence.h"
+#include "server.h"
+#include "sampler.h"
+#include "mesh_query.h"
+#include "hash_benchmark.h"
+#include "distance_benchmark.h"
+#include "mesh_order.h"
+#include "shard.h"
+#include "pipeline.h"
+#include "sdfop.h"
+#include "marching_cubes.h"
+#include "pyramid.h"
+#include "cpu_dispatch.h"
+#include "grid_memory.h"
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <limits>
+#include <memory>
 
 using std::cout;
 
@@ -31,20 +47,227 @@ const char* help_msg =
 
     "The output filename will match that of the input, with the OBJ suffix replaced with SDF.\n\n"
 
-    "Usage: SDFGen <filename> <dx> <padding>\n\n"
+    "Usage: SDFGen <filename> <dx> <padding> [options]\n\n"
     "Where:\n"
     "  <filename> specifies a Wavefront OBJ (text) file representing a *triangle* mesh\n"
     "             (no quad or poly meshes allowed). File must use the suffix \".obj\".\n"
     "  <dx> specifies the length of grid cell in the resulting distance field.\n"
     "  <padding> specifies the number of cells worth of padding between the\n"
     "            object bound box and the boundary of the distance field grid.\n"
-    "            Minimum is 1.\n\n";
+    "            Minimum is 1.\n\n"
+
+    "Options:\n"
+    "  --frames <list>     Generate one field per frame of an animated sequence, written\n"
+    "                      to <basename>_<frame>.vtr on the grid of the input mesh.\n"
+    "                      Each line of <list> is either a mesh file with the same\n"
+    "                      triangles as the input, or a rigid transform given as the\n"
+    "                      12 numbers r00 r01 r02 t0 r10 r11 r12 t1 r20 r21 r22 t2.\n"
+    "  --tolerance <d>     Distance error allowed when a frame reuses the previous one\n"
+    "                      (warm start or rigid resampling) instead of being recomputed.\n"
+    "                      Default is half a cell (0.5*dx), which resamples rigid\n"
+    "                      frames that translate along one axis (the interpolation\n"
+    "                      error is up to 0.5*dx), while rotations by arbitrary\n"
+    "                      angles need up to 0.87*dx and are recomputed; 0 allows\n"
+    "                      only lossless reuse.\n"
+    "  --format <f>        Output format: vtk (default, <basename>.vtr) or binary\n"
+    "                      (<basename>.sdf, see binary_output.h).\n"
+    "  --precision <p>     Stored precision of phi in binary output: float (default),\n"
+    "                      half (saturating at +-65504), or int16 (fixed point over\n"
+    "                      +-band). Only the file shrinks: phi is computed in float\n"
+    "                      and quantized as it is written.\n"
+    "  --band <n>          Width in cells of the band kept exactly by int16 output;\n"
+    "                      values further out saturate. Default covers the whole grid.\n"
+    "  --engine <e>        How distances are extended away from the surface: sweep\n"
+    "                      (default, fast sweeping), march (bucketed fast marching) or\n"
+    "                      edt (distance transform from a two-cell surface band,\n"
+    "                      corrected by one sweeping pass).\n"
+    "  --stop-distance <d> Distance at which march stops; cells further away keep a\n"
+    "                      large placeholder magnitude. Default is no limit.\n"
+    "  --max-distance <d>  Truncate distances to +-d (TSDF). Work away from the surface\n"
+    "                      is skipped (sweep, march), and int16 output spans +-d unless\n"
+    "                      --band is given. Default is no truncation.\n"
+    "  --unsigned <t>      Unsigned distances for open surfaces and triangle soups:\n"
+    "                      no inside/outside test is made (saving its time and the\n"
+    "                      intersection count grid), and phi is |d|-t, i.e. the\n"
+    "                      signed distance of a shell of thickness 2t around the\n"
+    "                      surface (t=0 for plain unsigned distance).\n"
+    "  --channels <list>   Extra outputs written next to phi, comma separated: tri\n"
+    "                      (closest triangle index), point (closest surface point),\n"
+    "                      gradient (unit gradient of phi), object (index of the\n"
+    "                      closest object, see --union).\n"
+    "  --union <list>      Add the meshes listed in <list> (one file per line) as\n"
+    "                      objects 1, 2, ... next to the input mesh (object 0), and\n"
+    "                      compute the field of their union on one grid in one pass:\n"
+    "                      distances are to the nearest object, and a node is inside\n"
+    "                      if it is inside any object. Triangle indices count through\n"
+    "                      the meshes in order.\n"
+    "  --order <o>         Order in which triangles are processed: file (default)\n"
+    "                      or morton (sorted along a Morton curve for cache\n"
+    "                      locality; rounds values slightly differently).\n"
+    "                      Triangle indices in the output always refer to the file.\n"
+    "  --shard <i>/<n>     Compute only slab i (0 to n-1) of n equal slabs along z,\n"
+    "                      written to <basename>_shard<i>.sdf (binary format). Each\n"
+    "                      shard reads the whole mesh but only grids its slab plus a\n"
+    "                      halo, so shards can run as separate processes or on separate\n"
+    "                      machines; combine them with SDFGen merge.\n"
+    "  --domain <x>,<y>,<z>,<ni>,<nj>,<nk>\n"
+    "                      Use the grid with origin (x,y,z) and ni x nj x nk nodes\n"
+    "                      instead of the padded mesh bounds (<padding> is ignored).\n"
+    "                      Since the grid is then known before the mesh is read, a\n"
+    "                      binary STL is rasterized in batches while it is still being\n"
+    "                      read (triangles in file order, so --order morton reads\n"
+    "                      the whole mesh first instead).\n"
+    "  --levels <n>        Also store coarser levels 1 to n-1 (spacing 2dx, 4dx, ...)\n"
+    "                      in the binary output, each as a grid record with its level\n"
+    "                      index. Level L keeps every 2^L-th node of the computed grid,\n"
+    "                      so all levels come from a single run. Coarse levels still\n"
+    "                      span the whole grid: a node past its end is evaluated from\n"
+    "                      the closest triangles of its fine neighbours.\n"
+    "  --contour <file>    Also extract the zero iso-surface of the result by marching\n"
+    "                      cubes, write it to <file> (binary STL, or PLY if it ends in\n"
+    "                      .ply) and report its deviation from the input mesh.\n\n"
+
+    "Other modes:\n"
+    "  SDFGen serve <socket> <file.sdf> [...]\n"
+    "      Maps binary SDF files and answers batched trilinear distance/gradient\n"
+    "      queries on a Unix domain socket (protocol in server.h).\n"
+    "  SDFGen query-bench <socket> <file.sdf> <grid> <points> <batch> [gradient]\n"
+    "      Measures the query throughput of a running server for one of its grids\n"
+    "      (<file.sdf> must be the file serving grid index <grid>).\n"
+    "  SDFGen sample-bench <file.sdf> <points>\n"
+    "      Checks the batched trilinear sampler against scalar trilerp on the first\n"
+    "      grid of the file and reports samples/second for each sampling mode.\n"
+    "  SDFGen sample-check [points]\n"
+    "      Compares the AVX2 gather path of the batched sampler with the scalar\n"
+    "      path on a synthetic grid (default 1000000 points); exits with status 1\n"
+    "      if they differ by more than rounding.\n"
+    "  SDFGen points <mesh> <points> <output>\n"
+    "      Computes exact signed distances from <mesh> at the points listed in the\n"
+    "      text file <points> (one \"x y z\" per line) without building a grid, and\n"
+    "      writes one distance per line to <output> in the same order.\n"
+    "  SDFGen hash-bench <n>\n"
+    "      Compares the chained HashTable with OpenHashTable on n random keys\n"
+    "      (insert, lookup, and HashGrid3 multi-value box queries), and with a\n"
+    "      bulk built CSRHashGrid3 for the box queries.\n"
+    "  SDFGen distance-bench <n>\n"
+    "      Times point_triangle_distance/closest and the Vec3f/Vec3d operations\n"
+    "      they use on n random triangles and points.\n"
+    "  SDFGen engine-check <mesh> <dx> <padding>\n"
+    "      Computes the field with each engine and compares it with exact\n"
+    "      distances at every node; exits with status 1 if march or edt is off\n"
+    "      by more than twice the sweep engine (or 0.05dx).\n"
+    "  SDFGen merge <output.sdf> <shard.sdf> [...]\n"
+    "      Stitches the files written by --shard into one binary SDF file, streaming\n"
+    "      them so the full grid is never held in memory.\n"
+    "  SDFGen sdfop <union|intersection|difference> <output.sdf> <a.sdf> <b.sdf> [...]\n"
+    "  SDFGen sdfop offset <output.sdf> <a.sdf> <distance>\n"
+    "      Combines the phi grids of binary SDF files (difference is a minus the\n"
+    "      others; offset grows a by distance) slab by slab with bounded memory.\n"
+    "      The result keeps the lattice and phi encoding of <a.sdf>; inputs on\n"
+    "      other lattices are resampled onto it, and beyond their own bounds are\n"
+    "      extended by the distance to them. int16 results are rescaled to cover\n"
+    "      the widest int16 input band plus the offset.\n"
+    "  SDFGen contour <file.sdf> <output.stl|.ply> [mesh] [iso]\n"
+    "      Extracts the iso-surface phi = iso (default 0) of the first grid of the\n"
+    "      file by parallel marching cubes and writes it as binary STL or PLY.\n"
+    "      Given the input mesh, also reports the deviation between the two.\n\n";
 
 
 
 int main(int argc, char** argv) {
-  
-    if (argc != 4) {
+
+    auto mode = std::string{argc > 1 ? argv[1] : ""};
+    if (mode == "serve" && argc >= 4) {
+        run_server(argv[2], std::vector<std::string>(argv+3, argv+argc));
+        return 0;
+    }
+    if (mode == "query-bench" && argc >= 7) {
+        auto grids = map_binary(argv[3]);
+        if (grids.empty()) {
+            std::cerr << "Error: " << argv[3] << " holds no grids.\n";
+            exit(-1);
+        }
+        run_query_benchmark(argv[2], grids[0], from_string<unsigned>(argv[4]),
+                            from_string<unsigned>(argv[5]), from_string<unsigned>(argv[6]),
+                            argc > 7 && lower(argv[7]) == "gradient");
+        return 0;
+    }
+    if (mode == "sample-bench" && argc >= 4) {
+        auto grids = read_binary(argv[2]);
+        const Channel *phi = grids.empty() ? nullptr : grids[0].find("phi");
+        if (!phi) {
+            std::cerr << "Error: " << argv[2] << " holds no phi grid.\n";
+            exit(-1);
+        }
+        auto &g = grids[0];
+        std::vector<float> values((size_t)g.ni*g.nj*g.nk);
+        for (size_t n=0; n<values.size(); ++n) values[n] = (*phi)[n];
+        GridView view = {&values[0], g.ni, g.nj, g.nk, g.origin, g.dx};
+        run_sample_benchmark(view, from_string<size_t>(argv[3]));
+        return 0;
+    }
+    if (mode == "points" && argc >= 5) {
+        auto mesh = read_mesh(argv[2]);
+        auto points = read_points(argv[3]);
+        cout << "Computing signed distances at " << points.size() << " points.\n";
+        std::vector<float> phi;
+        signed_distance_at_points(mesh.faceList, mesh.vertList, points, phi);
+        std::ofstream outfile(argv[4]);
+        outfile.precision(std::numeric_limits<float>::max_digits10);
+        for (auto d: phi) outfile << d << "\n";
+        if (!outfile) {
+            std::cerr << "Error: Cannot write " << argv[4] << ".\n";
+            exit(-1);
+        }
+        cout << "Processing complete.\n";
+        return 0;
+    }
+    if (mode == "hash-bench" && argc >= 3) {
+        run_hash_benchmark(from_string<unsigned>(argv[2]));
+        return 0;
+    }
+    if (mode == "distance-bench" && argc >= 3) {
+        run_distance_benchmark(from_string<unsigned>(argv[2]));
+        return 0;
+    }
+    if (mode == "sample-check") {
+        return run_sample_check(argc > 2 ? from_string<size_t>(argv[2]) : 1000000) ? 0 : 1;
+    }
+    if (mode == "engine-check" && argc >= 5) {
+        auto mesh = read_mesh(argv[2]);
+        return run_engine_check(mesh.faceList, mesh.vertList, from_string<float>(argv[3]),
+                                from_string<int>(argv[4])) ? 0 : 1;
+    }
+    if (mode == "merge" && argc >= 4) {
+        merge_shards(argv[2], std::vector<std::string>(argv+3, argv+argc));
+        return 0;
+    }
+    if (mode == "contour" && argc >= 4) {
+        auto grids = map_binary(argv[2]);
+        const Channel *phi = grids.empty() ? nullptr : grids[0].find("phi");
+        if (!phi) {
+            std::cerr << "Error: " << argv[2] << " holds no phi grid.\n";
+            exit(-1);
+        }
+        Triangulation surface, reference;
+        extract_isosurface(grids[0], *phi, argc > 5 ? from_string<float>(argv[5]) : 0, surface);
+        write_mesh(argv[3], surface);
+        if (argc > 4) reference = read_mesh(argv[4]);
+        print_surface_check(surface, argc > 4 ? &reference : nullptr, grids[0].dx);
+        return 0;
+    }
+    if (mode == "sdfop" && argc >= 6) {
+        auto op = sdf_operation_from_string(argv[2]);
+        if (op == SDF_OFFSET) {
+            run_sdf_operation(op, argv[3], std::vector<std::string>(1, argv[4]), from_string<float>(argv[5]));
+        }
+        else {
+            run_sdf_operation(op, argv[3], std::vector<std::string>(argv+4, argv+argc));
+        }
+        return 0;
+    }
+
+    if (argc < 4) {
         std::cerr << help_msg;
         exit(-1);
     }
@@ -52,6 +275,106 @@ int main(int argc, char** argv) {
     auto dx        = from_string<float>(argv[2]);
     auto padding   = from_string<int>(argv[3]);
 
+    std::string frame_list;
+    std::string union_list;
+    std::string contour;
+    int num_levels = 1;
+    float tolerance = -1; // set from dx below unless given
+    std::string format = "vtk";
+    Encoding precision = ENCODE_FLOAT32;
+    float band = 0;
+    LevelSetOptions opts;
+    LevelSetChannels channels;
+    bool write_tri = false;
+    bool morton = false;
+    int shard = 0, num_shards = 0;
+    bool has_domain = false;
+    Vec3f domain_origin;
+    Vec3ui domain_sizes;
+    for (int a=4; a<argc; ++a) {
+        auto opt = std::string{argv[a]};
+        if (a+1 == argc) {
+            std::cerr << "Error: Missing value for option " << opt << ".\n";
+            exit(-1);
+        }
+        if (opt == "--frames")         frame_list = argv[++a];
+        else if (opt == "--union")     union_list = argv[++a];
+        else if (opt == "--contour")   contour    = argv[++a];
+        else if (opt == "--levels")    num_levels = from_string<int>(argv[++a]);
+        else if (opt == "--tolerance") tolerance  = from_string<float>(argv[++a]);
+        else if (opt == "--format")    format     = lower(argv[++a]);
+        else if (opt == "--precision") precision  = encoding_from_string(lower(argv[++a]));
+        else if (opt == "--band")      band       = from_string<float>(argv[++a]);
+        else if (opt == "--engine") {
+            auto engine = lower(argv[++a]);
+            if (engine == "sweep")      opts.engine = ENGINE_SWEEP;
+            else if (engine == "march") opts.engine = ENGINE_MARCH;
+            else if (engine == "edt") {
+                // A band of two cells gives the transform good enough guesses for
+                // one sweeping pass to reach the accuracy of the sweep engine.
+                opts.engine = ENGINE_EDT;
+                opts.exact_band = 2;
+            }
+            else {
+                std::cerr << "Error: Unknown engine " << engine << ".\n";
+                exit(-1);
+            }
+        }
+        else if (opt == "--stop-distance") opts.stop_distance = from_string<float>(argv[++a]);
+        else if (opt == "--max-distance")  opts.max_distance = from_string<float>(argv[++a]);
+        else if (opt == "--unsigned") {
+            opts.unsigned_distance = true;
+            opts.shell = from_string<float>(argv[++a]);
+        }
+        else if (opt == "--order") {
+            auto order = lower(argv[++a]);
+            if (order != "morton" && order != "file") {
+                std::cerr << "Error: Unknown triangle order " << order << ".\n";
+                exit(-1);
+            }
+            morton = order == "morton";
+        }
+        else if (opt == "--shard") {
+            auto parts = split(argv[++a], "/");
+            if (parts.size() == 2) {
+                shard = from_string<int>(parts[0]);
+                num_shards = from_string<int>(parts[1]);
+            }
+            if (parts.size() != 2 || num_shards < 1 || shard < 0 || shard >= num_shards) {
+                std::cerr << "Error: Shard must be given as <i>/<n> with 0 <= i < n.\n";
+                exit(-1);
+            }
+        }
+        else if (opt == "--domain") {
+            auto parts = split(argv[++a], ",");
+            if (parts.size() != 6) {
+                std::cerr << "Error: Domain must be given as <x>,<y>,<z>,<ni>,<nj>,<nk>.\n";
+                exit(-1);
+            }
+            for (int d=0; d<3; ++d) {
+                domain_origin[d] = from_string<float>(parts[d]);
+                domain_sizes[d] = from_string<unsigned>(parts[3+d]);
+            }
+            has_domain = true;
+        }
+        else if (opt == "--channels") {
+            for (auto c: split(lower(argv[++a]), ",")) {
+                if (c == "tri")           write_tri = true;
+                else if (c == "point")    channels.closest_points = true;
+                else if (c == "gradient") channels.gradients = true;
+                else if (c == "object")   channels.objects = true;
+                else {
+                    std::cerr << "Error: Unknown channel " << c << ".\n";
+                    exit(-1);
+                }
+            }
+        }
+        else {
+            std::cerr << "Error: Unknown option " << opt << ".\n" << help_msg;
+            exit(-1);
+        }
+    }
+
     auto dot = filename.find_last_of('.');
     if (dot == std::string::npos) {
         std::cerr << "Error: Input file must have .stl or .obj extension.\n";
@@ -59,46 +382,195 @@ int main(int argc, char** argv) {
     }
     auto extension = filename.substr(dot+1);
     auto basename  = filename.substr(0, dot);
-    //auto outname   = basename + std::string(".sdf");
-    auto outname   = basename + std::string(".vtr");
+    if (format != "vtk" && format != "binary") {
+        std::cerr << "Error: Unknown output format " << format << ".\n";
+        exit(-1);
+    }
+    if (format == "vtk" && precision != ENCODE_FLOAT32) {
+        std::cerr << "Error: Reduced precision requires --format binary.\n";
+        exit(-1);
+    }
+    if (!union_list.empty() && !frame_list.empty()) {
+        std::cerr << "Error: --union cannot be combined with --frames.\n";
+        exit(-1);
+    }
+    if (num_levels < 1 || (num_levels > 1 && (format != "binary" || num_shards || !frame_list.empty()))) {
+        std::cerr << "Error: --levels must be at least 1, and more than one level requires\n"
+                  << "       --format binary and no --shard or --frames.\n";
+        exit(-1);
+    }
+    if (opts.unsigned_distance && (opts.shell < 0 || !frame_list.empty())) {
+        std::cerr << "Error: --unsigned needs a shell thickness of at least 0, and cannot be\n"
+                  << "       combined with --frames.\n";
+        exit(-1);
+    }
+    if (!frame_list.empty() && (format != "vtk" || opts.engine != ENGINE_SWEEP || write_tri
+                                || channels.closest_points || channels.gradients || channels.objects)) {
+        std::cerr << "Error: --frames writes phi only, as vtk computed by the sweep engine, so it\n"
+                  << "       cannot be combined with --format, --engine or --channels.\n";
+        exit(-1);
+    }
+    if (tolerance < 0) tolerance = 0.5f*dx;
+    if (!contour.empty() && (num_shards || !frame_list.empty())) {
+        std::cerr << "Error: --contour cannot be combined with --shard or --frames.\n";
+        exit(-1);
+    }
+    if (num_shards && (format != "binary" || !frame_list.empty())) {
+        std::cerr << "Error: --shard requires --format binary and no --frames.\n";
+        exit(-1);
+    }
+    // Truncated fields are stored over exactly their range by default.
+    float range = band > 0 ? band*dx : opts.max_distance;
+    if (num_shards && precision == ENCODE_INT16 && range <= 0) {
+        std::cerr << "Error: Sharded int16 output needs --band or --max-distance, so that\n"
+                  << "       every shard is quantized with the same scale.\n";
+        exit(-1);
+    }
+    auto outname   = basename + std::string(format == "binary" ? ".sdf" : ".vtr");
+    if (num_shards) outname = basename + "_shard" + std::to_string(shard) + ".sdf";
     
     cout << "File name is   " << filename << "\n";
     cout << "Extension is   " << extension << "\n";
     cout << "Base name is   " << basename << "\n";
     cout << "Output name is " << outname<< "\n";
+    cout << "Vector kernels: " << cpu_dispatch_name() << "\n";
 
+    // With the grid given up front, a binary STL is read while it is rasterized.  That
+    // takes the triangles in file order, so Morton ordering reads the mesh first.
+    bool pipelined = has_domain && lower(extension) == "stl" && frame_list.empty() && !num_shards
+                  && union_list.empty() && !morton;
     Triangulation mesh;
-    if (lower(extension) == "stl") {
-        //mesh = read_ascii_stl(filename);
-        mesh = read_binary_stl(filename);
+    if (!pipelined) mesh = read_mesh(filename);
+
+    // The object of each triangle, in file order.
+    std::vector<int> tri_object;
+    if (!union_list.empty()) {
+        auto parts = read_file_list(union_list);
+        tri_object.assign(mesh.faceList.size(), 0);
+        for (size_t p=0; p<parts.size(); ++p) {
+            append_mesh(mesh, read_mesh(parts[p]));
+            tri_object.resize(mesh.faceList.size(), p+1);
+        }
+        cout << "Union of " << parts.size()+1 << " objects with " << mesh.faceList.size() << " triangles.\n";
+        opts.tri_object = &tri_object;
     }
-    else if (lower(extension) == "obj") {
-        mesh = read_obj_file(filename);
+
+    Vec3ui sizes;
+    if (has_domain) {
+        sizes = domain_sizes;
+        mesh.min_box = domain_origin;
+        mesh.max_box = domain_origin + dx*Vec3f(sizes - Vec3ui(1,1,1));
     }
     else {
-        std::cerr << "Error: Input file must have .stl or .obj extension.\n";
-        exit(-1);
+        // Add padding around the box.
+        Vec3f unit(1.0,1.0,1.0);
+        if (padding < 1) padding = 1;
+        mesh.min_box -= padding*dx*unit;
+        mesh.max_box += padding*dx*unit;
+        sizes = Vec3ui((mesh.max_box - mesh.min_box)/dx);
     }
 
-    // Add padding around the box.
-    Vec3f unit(1.0,1.0,1.0);
-    if (padding < 1) padding = 1;
-    mesh.min_box -= padding*dx*unit;
-    mesh.max_box += padding*dx*unit;
-    Vec3ui sizes = Vec3ui((mesh.max_box - mesh.min_box)/dx);
-
     cout << "Bound box size: (" << mesh.min_box << ") to (" 
          << mesh.max_box << ") with dimensions " << sizes << ".\n";
 
-    cout << "Computing signed distance field.\n";
+    if (!frame_list.empty()) {
+        cout << "Computing signed distance fields for each frame.\n";
+        auto frames = read_frame_list(frame_list);
+        make_level_set_sequence(mesh, frames, mesh.min_box, dx, sizes, basename, tolerance);
+        cout << "Processing complete.\n";
+        return 0;
+    }
+
     Array3f phi_grid;
-    make_level_set3(mesh.faceList, mesh.vertList, mesh.min_box, 
-            dx, sizes[0], sizes[1], sizes[2], phi_grid);
+    Array3i closest_tri;
+    Vec3f origin = mesh.min_box;
+    std::vector<int> original_tri;
+    // Binary output of a whole grid is written while the final pass finishes layers.
+    std::unique_ptr<AsyncBinaryWriter> writer;
+    if (format == "binary" && !num_shards && num_levels == 1) {
+        cout << "Writing results to: " << outname << "\n";
+        writer.reset(new AsyncBinaryWriter(outname, mesh.min_box, dx, precision, range, write_tri,
+                                           morton ? &original_tri : nullptr));
+    }
+    if (pipelined) {
+        cout << "Computing signed distance field while reading the mesh.\n";
+        Vec3f min_box = mesh.min_box, max_box = mesh.max_box;
+        make_level_set3_pipelined(filename, min_box, dx, sizes, phi_grid, closest_tri,
+                                  opts, &channels, mesh, writer.get());
+        mesh.min_box = min_box;
+        mesh.max_box = max_box;
+    }
+    else if (num_shards) {
+        int k0, k1;
+        shard_layers(shard, num_shards, sizes[2], k0, k1);
+        cout << "Computing signed distance field for shard " << shard << " of " << num_shards << ".\n";
+        make_level_set_shard(mesh, mesh.min_box, dx, sizes, k0, k1, morton,
+                             phi_grid, closest_tri, opts, &channels);
+        origin[2] += k0*dx;
+    }
+    else {
+        if (morton) reorder_mesh(mesh.faceList, mesh.vertList, original_tri);
+        if (morton && opts.tri_object) {
+            std::vector<int> sorted(tri_object.size());
+            for (size_t t=0; t<sorted.size(); ++t) sorted[t] = tri_object[original_tri[t]];
+            tri_object.swap(sorted);
+        }
+
+        cout << "Computing signed distance field.\n";
+        make_level_set3(mesh.faceList, mesh.vertList, mesh.min_box, 
+                dx, sizes[0], sizes[1], sizes[2], phi_grid, closest_tri, opts, &channels,
+                writer.get());
+        if (morton && write_tri) {
+            for (auto &t: closest_tri.a) if (t >= 0) t = original_tri[t];
+        }
+    }
+
+    cout << grid_memory_summary() << "\n";
+
+    if (!contour.empty()) {
+        cout << "Extracting the zero iso-surface to " << contour << "\n";
+        Triangulation surface;
+        extract_isosurface(phi_grid, origin, dx, 0, surface);
+        write_mesh(contour, surface);
+        print_surface_check(surface, &mesh, dx);
+    }
+
+    if (writer) {
+        auto error = writer->finish();
+        if (precision != ENCODE_FLOAT32) {
+            cout << "Maximum quantization error: " << error << "\n";
+        }
+        cout << "Processing complete.\n";
+        return 0;
+    }
 
     // Very hackily strip off file suffix.
     cout << "Writing results to: " << outname << "\n";
 
-    write_as_vtk(outname, phi_grid, mesh.min_box, mesh.max_box);
+    if (format == "binary" && num_levels > 1) {
+        // closest_tri is in file order by now if it is written, so the triangles must be too.
+        std::vector<Vec3ui> tri = mesh.faceList;
+        if (morton && write_tri) {
+            for (size_t t=0; t<tri.size(); ++t) tri[original_tri[t]] = mesh.faceList[t];
+        }
+        auto error = write_pyramid_as_binary(outname, num_levels, phi_grid, closest_tri, tri,
+                                             mesh.vertList, origin, dx, opts, precision, range,
+                                             write_tri, &channels);
+        if (precision != ENCODE_FLOAT32) {
+            cout << "Maximum quantization error: " << error << "\n";
+        }
+    }
+    else if (format == "binary") {
+        auto error = write_as_binary(outname, phi_grid, origin, dx, precision, range,
+                                     write_tri ? &closest_tri : nullptr, &channels);
+        if (precision != ENCODE_FLOAT32) {
+            cout << "Maximum quantization error: " << error << "\n";
+        }
+    }
+    else {
+        write_as_vtk(outname, phi_grid, mesh.min_box, mesh.max_box,
+                     write_tri ? &closest_tri : nullptr, &channels);
+    }
     /*
     std::ofstream outfile(outname);
     outfile << phi_grid.ni << " " << phi_grid.nj << " " << phi_grid.nk << "\n";
@@ -1,4 +1,13 @@
 #include "makelevelset3.h"
+#include "hashgrid.h"
+#include "cpu_dispatch.h"
+#include "grid_memory.h"
+#include <algorithm>
+#include <limits>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define LEVELSET_HAVE_AVX2_PATH
+#endif
 
 // find distance x0 is from segment x1-x2
 static float point_segment_distance(const Vec3f &x0, const Vec3f &x1, const Vec3f &x2)
@@ -16,17 +25,39 @@ static float point_segment_distance(const Vec3f &x0, const Vec3f &x1, const Vec3
    return dist(x0, s12*x1+(1-s12)*x2);
 }
 
+// whether m13*m23-d*d, the determinant of the barycentric system, cancels too much
+// for single precision (slivers)
+static inline bool is_sliver(float m13, float m23, float d)
+{
+   return m13*m23-d*d<=1e-3f*(m13*m23);
+}
+
+// barycentric coordinates w23, w31 of the closest point on the infinite plane, in
+// single precision unless the triangle is a sliver
+static inline void plane_weights(const Vec3f &x13, const Vec3f &x23, const Vec3f &x03, float &w23, float &w31)
+{
+   float m13=mag2(x13), m23=mag2(x23), d=dot(x13,x23);
+   if(!is_sliver(m13,m23,d)){
+      float invdet=1.f/max(m13*m23-d*d,1e-30f);
+      float a=dot(x13,x03), b=dot(x23,x03);
+      w23=invdet*(m23*a-d*b);
+      w31=invdet*(m13*b-d*a);
+   }else{
+      Vec3d y13(x13), y23(x23), y03(x03);
+      double n13=mag2(y13), n23=mag2(y23), e=dot(y13,y23);
+      double invdet=1./max(n13*n23-e*e,1e-30);
+      double a=dot(y13,y03), b=dot(y23,y03);
+      w23=(float)(invdet*(n23*a-e*b));
+      w31=(float)(invdet*(n13*b-e*a));
+   }
+}
+
 // find distance x0 is from triangle x1-x2-x3
-static float point_triangle_distance(const Vec3f &x0, const Vec3f &x1, const Vec3f &x2, const Vec3f &x3)
+float point_triangle_distance(const Vec3f &x0, const Vec3f &x1, const Vec3f &x2, const Vec3f &x3)
 {
    // first find barycentric coordinates of closest point on infinite plane
-   Vec3f x13(x1-x3), x23(x2-x3), x03(x0-x3);
-   float m13=mag2(x13), m23=mag2(x23), d=dot(x13,x23);
-   float invdet=1.f/max(m13*m23-d*d,1e-30f);
-   float a=dot(x13,x03), b=dot(x23,x03);
-   // the barycentric coordinates themselves
-   float w23=invdet*(m23*a-d*b);
-   float w31=invdet*(m13*b-d*a);
+   float w23, w31;
+   plane_weights(x1-x3, x2-x3, x0-x3, w23, w31);
    float w12=1-w23-w31;
    if(w23>=0 && w31>=0 && w12>=0){ // if we're inside the triangle
       return dist(x0, w23*x1+w31*x2+w12*x3); 
@@ -40,11 +71,163 @@ static float point_triangle_distance(const Vec3f &x0, const Vec3f &x1, const Vec
    }
 }
 
+#ifdef LEVELSET_HAVE_AVX2_PATH
+// a+b*c for each lane, rounding the product first as the scalar code does
+__attribute__((target("avx2")))
+static inline __m256 add_mul_avx2(__m256 a, __m256 b, float c)
+{ return _mm256_add_ps(a, _mm256_mul_ps(b, _mm256_set1_ps(c))); }
+
+// lanes 0-3 and 4-7 of x as doubles, and back
+__attribute__((target("avx2")))
+static inline __m256d low_to_double_avx2(__m256 x) { return _mm256_cvtps_pd(_mm256_castps256_ps128(x)); }
+__attribute__((target("avx2")))
+static inline __m256d high_to_double_avx2(__m256 x) { return _mm256_cvtps_pd(_mm256_extractf128_ps(x,1)); }
+__attribute__((target("avx2")))
+static inline __m256 to_float_avx2(__m256d lo, __m256d hi)
+{ return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(lo)), _mm256_cvtpd_ps(hi), 1); }
+
+// point_segment_distance from the lanes (px,py,pz) to segment s-t, with the scalar
+// code's operations in the same order
+__attribute__((target("avx2")))
+static inline __m256 segment_distance_avx2(__m256 px, float py, float pz, const Vec3f &s, const Vec3f &t)
+{
+   Vec3f e(t-s);
+   __m256d m2=_mm256_set1_pd((double)mag2(e));
+   __m256 dot=add_mul_avx2(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(t[0]), px), _mm256_set1_ps(e[0])),
+                           _mm256_set1_ps(t[1]-py), e[1]);
+   dot=add_mul_avx2(dot, _mm256_set1_ps(t[2]-pz), e[2]);
+   __m256 s12=to_float_avx2(_mm256_div_pd(low_to_double_avx2(dot), m2), _mm256_div_pd(high_to_double_avx2(dot), m2));
+   __m256 zero=_mm256_setzero_ps(), one=_mm256_set1_ps(1);
+   __m256 c=_mm256_blendv_ps(s12, one, _mm256_cmp_ps(s12, one, _CMP_GT_OQ));
+   s12=_mm256_blendv_ps(c, zero, _mm256_cmp_ps(s12, zero, _CMP_LT_OQ));
+   __m256 r=_mm256_sub_ps(one, s12);
+   __m256 qx=_mm256_add_ps(_mm256_mul_ps(s12, _mm256_set1_ps(s[0])), _mm256_mul_ps(r, _mm256_set1_ps(t[0])));
+   __m256 qy=_mm256_add_ps(_mm256_mul_ps(s12, _mm256_set1_ps(s[1])), _mm256_mul_ps(r, _mm256_set1_ps(t[1])));
+   __m256 qz=_mm256_add_ps(_mm256_mul_ps(s12, _mm256_set1_ps(s[2])), _mm256_mul_ps(r, _mm256_set1_ps(t[2])));
+   __m256 dx=_mm256_sub_ps(px, qx), dy=_mm256_sub_ps(_mm256_set1_ps(py), qy), dz=_mm256_sub_ps(_mm256_set1_ps(pz), qz);
+   return _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx,dx), _mm256_mul_ps(dy,dy)), _mm256_mul_ps(dz,dz)));
+}
+
+// eight cells of the row at a time, all cases evaluated and then selected
+__attribute__((target("avx2")))
+static int point_triangle_distance_row_avx2(float x0, float dx, int i0, int i1, float y0, float z0,
+                                            const Vec3f &x1, const Vec3f &x2, const Vec3f &x3, float *d)
+{
+   Vec3f x13(x1-x3), x23(x2-x3);
+   float m13=mag2(x13), m23=mag2(x23), dd=dot(x13,x23);
+   bool sliver=is_sliver(m13,m23,dd);
+   // the parts of the dot products that are the same along the row, in single
+   // precision and, for slivers, in double
+   float x03b=y0-x3[1], x03c=z0-x3[2];
+   __m256 fa1=_mm256_set1_ps(x13[1]*x03b), fa2=_mm256_set1_ps(x13[2]*x03c);
+   __m256 fb1=_mm256_set1_ps(x23[1]*x03b), fb2=_mm256_set1_ps(x23[2]*x03c);
+   __m256 fva=_mm256_set1_ps(x13[0]), fvb=_mm256_set1_ps(x23[0]);
+   __m256 fm13=_mm256_set1_ps(m13), fm23=_mm256_set1_ps(m23), fdd=_mm256_set1_ps(dd);
+   __m256 finv=_mm256_set1_ps(1.f/max(m13*m23-dd*dd,1e-30f));
+   Vec3d y13(x13), y23(x23);
+   double n13=mag2(y13), n23=mag2(y23), e=dot(y13,y23);
+   __m256d a1=_mm256_set1_pd(y13[1]*(double)x03b), a2=_mm256_set1_pd(y13[2]*(double)x03c);
+   __m256d b1=_mm256_set1_pd(y23[1]*(double)x03b), b2=_mm256_set1_pd(y23[2]*(double)x03c);
+   __m256d va=_mm256_set1_pd(y13[0]), vb=_mm256_set1_pd(y23[0]);
+   __m256d vm13=_mm256_set1_pd(n13), vm23=_mm256_set1_pd(n23), vdd=_mm256_set1_pd(e);
+   __m256d vinv=_mm256_set1_pd(1./max(n13*n23-e*e,1e-30));
+   __m256 zero=_mm256_setzero_ps(), one=_mm256_set1_ps(1);
+   int i=i0;
+   for(; i+7<=i1; i+=8){
+      __m256 px=_mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(i),
+                                 _mm256_setr_epi32(0,1,2,3,4,5,6,7))), _mm256_set1_ps(dx)), _mm256_set1_ps(x0));
+      __m256 x03a=_mm256_sub_ps(px, _mm256_set1_ps(x3[0]));
+      // a=dot(x13,x03) and b=dot(x23,x03), then the barycentric weights
+      __m256 w23, w31;
+      if(!sliver){
+         __m256 a=_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(fva,x03a), fa1), fa2);
+         __m256 b=_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(fvb,x03a), fb1), fb2);
+         w23=_mm256_mul_ps(finv, _mm256_sub_ps(_mm256_mul_ps(fm23,a), _mm256_mul_ps(fdd,b)));
+         w31=_mm256_mul_ps(finv, _mm256_sub_ps(_mm256_mul_ps(fm13,b), _mm256_mul_ps(fdd,a)));
+      }else{
+         __m256d t[2]={low_to_double_avx2(x03a), high_to_double_avx2(x03a)}, u23[2], u31[2];
+         for(int h=0; h<2; ++h){
+            __m256d a=_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(va,t[h]), a1), a2);
+            __m256d b=_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(vb,t[h]), b1), b2);
+            u23[h]=_mm256_mul_pd(vinv, _mm256_sub_pd(_mm256_mul_pd(vm23,a), _mm256_mul_pd(vdd,b)));
+            u31[h]=_mm256_mul_pd(vinv, _mm256_sub_pd(_mm256_mul_pd(vm13,b), _mm256_mul_pd(vdd,a)));
+         }
+         w23=to_float_avx2(u23[0], u23[1]);
+         w31=to_float_avx2(u31[0], u31[1]);
+      }
+      __m256 w12=_mm256_sub_ps(_mm256_sub_ps(one, w23), w31);
+      __m256 c[3];
+      for(int k=0; k<3; ++k)
+         c[k]=add_mul_avx2(add_mul_avx2(_mm256_mul_ps(w23, _mm256_set1_ps(x1[k])), w31, x2[k]), w12, x3[k]);
+      __m256 fx=_mm256_sub_ps(px, c[0]), fy=_mm256_sub_ps(_mm256_set1_ps(y0), c[1]), fz=_mm256_sub_ps(_mm256_set1_ps(z0), c[2]);
+      __m256 face=_mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(fx,fx), _mm256_mul_ps(fy,fy)), _mm256_mul_ps(fz,fz)));
+      __m256 d12=segment_distance_avx2(px, y0, z0, x1, x2);
+      __m256 d13=segment_distance_avx2(px, y0, z0, x1, x3);
+      __m256 d23=segment_distance_avx2(px, y0, z0, x2, x3);
+      // min(d12,d13) if w23>0, else min(d12,d23) if w31>0, else min(d13,d23)
+      __m256 pos23=_mm256_cmp_ps(w23, zero, _CMP_GT_OQ), pos31=_mm256_cmp_ps(w31, zero, _CMP_GT_OQ);
+      __m256 e0=_mm256_blendv_ps(d13, d12, _mm256_or_ps(pos23, pos31));
+      __m256 e1=_mm256_blendv_ps(d23, d13, pos23);
+      __m256 edge=_mm256_min_ps(e1, e0);
+      __m256 inside=_mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(w23, zero, _CMP_GE_OQ), _mm256_cmp_ps(w31, zero, _CMP_GE_OQ)),
+                                  _mm256_cmp_ps(w12, zero, _CMP_GE_OQ));
+      _mm256_storeu_ps(d+(i-i0), _mm256_blendv_ps(edge, face, inside));
+   }
+   return i;
+}
+#endif
+
+// point_triangle_distance for the cells of a row, vectorized with AVX2 where the CPU
+// has it.  each lane repeats the scalar operations in the same order, so the
+// results are identical
+void point_triangle_distance_row(float x0, float dx, int i0, int i1, float y0, float z0,
+                                 const Vec3f &x1, const Vec3f &x2, const Vec3f &x3, float *d)
+{
+   int i=i0;
+#ifdef LEVELSET_HAVE_AVX2_PATH
+   if(cpu_has_avx2()) i=point_triangle_distance_row_avx2(x0, dx, i0, i1, y0, z0, x1, x2, x3, d);
+#endif
+   for(; i<=i1; ++i)
+      d[i-i0]=point_triangle_distance(Vec3f(i*dx+x0, y0, z0), x1, x2, x3);
+}
+
+// find the point on segment x1-x2 closest to x0
+static Vec3f point_segment_closest(const Vec3f &x0, const Vec3f &x1, const Vec3f &x2)
+{
+   Vec3f dx(x2-x1);
+   double m2=mag2(dx);
+   float s12=(float)(dot(x2-x0, dx)/m2);
+   s12=clamp(s12, 0.f, 1.f);
+   return s12*x1+(1-s12)*x2;
+}
+
+// find the point on triangle x1-x2-x3 closest to x0 (same cases as point_triangle_distance)
+Vec3f point_triangle_closest(const Vec3f &x0, const Vec3f &x1, const Vec3f &x2, const Vec3f &x3)
+{
+   float w23, w31;
+   plane_weights(x1-x3, x2-x3, x0-x3, w23, w31);
+   float w12=1-w23-w31;
+   if(w23>=0 && w31>=0 && w12>=0)
+      return w23*x1+w31*x2+w12*x3;
+   // the closer of the two candidate edges
+   Vec3f c0, c1;
+   if(w23>0){
+      c0=point_segment_closest(x0,x1,x2); c1=point_segment_closest(x0,x1,x3);
+   }else if(w31>0){
+      c0=point_segment_closest(x0,x1,x2); c1=point_segment_closest(x0,x2,x3);
+   }else{
+      c0=point_segment_closest(x0,x1,x3); c1=point_segment_closest(x0,x2,x3);
+   }
+   return dist2(x0,c0)<=dist2(x0,c1) ? c0 : c1;
+}
+
+// neighbours further than limit from their closest triangle are skipped
 static void check_neighbour(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
                             Array3f &phi, Array3i &closest_tri,
-                            const Vec3f &gx, int i0, int j0, int k0, int i1, int j1, int k1)
+                            const Vec3f &gx, int i0, int j0, int k0, int i1, int j1, int k1,
+                            float limit)
 {
-   if(closest_tri(i1,j1,k1)>=0){
+   if(closest_tri(i1,j1,k1)>=0 && phi(i1,j1,k1)<=limit){
       unsigned int p, q, r; assign(tri[closest_tri(i1,j1,k1)], p, q, r);
       float d=point_triangle_distance(gx, x[p], x[q], x[r]);
       if(d<phi(i0,j0,k0)){
@@ -54,6 +237,70 @@ static void check_neighbour(const std::vector<Vec3ui> &tri, const std::vector<Ve
    }
 }
 
+// update cell (i,j,k) from its upwind neighbours in sweep direction (di,dj,dk)
+static inline void sweep_cell(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                              Array3f &phi, Array3i &closest_tri, const Vec3f &origin, float dx,
+                              int i, int j, int k, int di, int dj, int dk,
+                              float limit=std::numeric_limits<float>::max())
+{
+   Vec3f gx(i*dx+origin[0], j*dx+origin[1], k*dx+origin[2]);
+   check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i-di, j,    k, limit);
+   check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i,    j-dj, k, limit);
+   check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i-di, j-dj, k, limit);
+   check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i,    j,    k-dk, limit);
+   check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i-di, j,    k-dk, limit);
+   check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i,    j-dj, k-dk, limit);
+   check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i-di, j-dj, k-dk, limit);
+}
+
+// phi and closest_tri are given their initial values (an upper bound on distance, no
+// triangle) only when first needed, in blocks of init_block^3 cells: the blocks the
+// exact band reaches when they are rasterized, and the rest just before the first
+// sweep (or other engine) reads them.  initialized(b) marks the blocks done so far.
+static const int init_block=8;
+
+static float upper_bound(const Array3f &phi, float dx)
+{ return (phi.ni+phi.nj+phi.nk)*dx; }
+
+static void initialize_block(Array3f &phi, Array3i &closest_tri, Array3uc &initialized,
+                             float dx, const Vec3i &b)
+{
+   float bound=upper_bound(phi, dx);
+   int i0=b[0]*init_block, i1=min(i0+init_block, phi.ni);
+   int j0=b[1]*init_block, j1=min(j0+init_block, phi.nj);
+   int k0=b[2]*init_block, k1=min(k0+init_block, phi.nk);
+   for(int k=k0; k<k1; ++k) for(int j=j0; j<j1; ++j) for(int i=i0; i<i1; ++i){
+      phi(i,j,k)=bound;
+      closest_tri(i,j,k)=-1;
+   }
+   initialized(b[0],b[1],b[2])=1;
+}
+
+// initialize the cells of row (j,k) in blocks not yet initialized (leaving the marks)
+static void initialize_row(Array3f &phi, Array3i &closest_tri, const Array3uc &initialized,
+                           float bound, int j, int k)
+{
+   for(int b=0; b<initialized.ni; ++b){
+      if(initialized(b, j/init_block, k/init_block)) continue;
+      int i1=min((b+1)*init_block, phi.ni);
+      for(int i=b*init_block; i<i1; ++i){
+         phi(i,j,k)=bound;
+         closest_tri(i,j,k)=-1;
+      }
+   }
+}
+
+// initialize every block not yet initialized, in parallel by layer
+static void initialize_remaining(Array3f &phi, Array3i &closest_tri, Array3uc &initialized, float dx)
+{
+   float bound=upper_bound(phi, dx);
+   #pragma omp parallel for schedule(static)
+   for(int k=0; k<phi.nk; ++k) for(int j=0; j<phi.nj; ++j)
+      initialize_row(phi, closest_tri, initialized, bound, j, k);
+   initialized.assign((unsigned char)1);
+}
+
+MULTIVERSION
 static void sweep(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
                   Array3f &phi, Array3i &closest_tri, const Vec3f &origin, float dx,
                   int di, int dj, int dk)
@@ -67,15 +314,52 @@ static void sweep(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
    int k0, k1;
    if(dk>0){ k0=1; k1=phi.nk; }
    else{ k0=phi.nk-2; k1=-1; }
-   for(int k=k0; k!=k1; k+=dk) for(int j=j0; j!=j1; j+=dj) for(int i=i0; i!=i1; i+=di){
-      Vec3f gx(i*dx+origin[0], j*dx+origin[1], k*dx+origin[2]);
-      check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i-di, j,    k);
-      check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i,    j-dj, k);
-      check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i-di, j-dj, k);
-      check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i,    j,    k-dk);
-      check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i-di, j,    k-dk);
-      check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i,    j-dj, k-dk);
-      check_neighbour(tri, x, phi, closest_tri, gx, i, j, k, i-di, j-dj, k-dk);
+   for(int k=k0; k!=k1; k+=dk) for(int j=j0; j!=j1; j+=dj) for(int i=i0; i!=i1; i+=di)
+      sweep_cell(tri, x, phi, closest_tri, origin, dx, i, j, k, di, dj, dk);
+}
+
+// sweep(+1,+1,+1), initializing the rest of each row just before it is swept: rows
+// are reached in storage order, after their upwind neighbours, and are written while
+// in cache instead of in a pass over the grid of their own
+MULTIVERSION
+static void sweep_initializing(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                               Array3f &phi, Array3i &closest_tri, const Vec3f &origin, float dx,
+                               Array3uc &initialized)
+{
+   float bound=upper_bound(phi, dx);
+   for(int k=0; k<phi.nk; ++k) for(int j=0; j<phi.nj; ++j){
+      initialize_row(phi, closest_tri, initialized, bound, j, k);
+      if(j==0 || k==0) continue;
+      for(int i=1; i<phi.ni; ++i)
+         sweep_cell(tri, x, phi, closest_tri, origin, dx, i, j, k, +1, +1, +1);
+   }
+   initialized.assign((unsigned char)1);
+}
+
+// sweep restricted to the given blocks of block^3 cells: visiting the blocks in the
+// sweep direction still reaches every cell after its upwind neighbours
+MULTIVERSION
+static void sweep_blocks(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                         Array3f &phi, Array3i &closest_tri, const Vec3f &origin, float dx,
+                         std::vector<Vec3i> &blocks, int block, int di, int dj, int dk,
+                         float limit)
+{
+   int ni=phi.ni, nj=phi.nj, nk=phi.nk;
+   std::sort(blocks.begin(), blocks.end(), [&](const Vec3i &a, const Vec3i &b){
+      if(a[2]!=b[2]) return dk*a[2]<dk*b[2];
+      if(a[1]!=b[1]) return dj*a[1]<dj*b[1];
+      return di*a[0]<di*b[0];
+   });
+   for(size_t n=0; n<blocks.size(); ++n){
+      // the block's cells, excluding those without an upwind neighbour in the grid
+      int i0=max(block*blocks[n][0], di>0 ? 1 : 0), i1=min(block*blocks[n][0]+block, di>0 ? ni : ni-1)-1;
+      int j0=max(block*blocks[n][1], dj>0 ? 1 : 0), j1=min(block*blocks[n][1]+block, dj>0 ? nj : nj-1)-1;
+      int k0=max(block*blocks[n][2], dk>0 ? 1 : 0), k1=min(block*blocks[n][2]+block, dk>0 ? nk : nk-1)-1;
+      if(di<0) std::swap(i0, i1);
+      if(dj<0) std::swap(j0, j1);
+      if(dk<0) std::swap(k0, k1);
+      for(int k=k0; k!=k1+dk; k+=dk) for(int j=j0; j!=j1+dj; j+=dj) for(int i=i0; i!=i1+di; i+=di)
+         sweep_cell(tri, x, phi, closest_tri, origin, dx, i, j, k, di, dj, dk, limit);
    }
 }
 
@@ -95,9 +379,9 @@ static int orientation(double x1, double y1, double x2, double y2, double &twice
 
 // robust test of (x0,y0) in the triangle (x1,y1)-(x2,y2)-(x3,y3)
 // if true is returned, the barycentric coordinates are set in a,b,c.
-static bool point_in_triangle_2d(double x0, double y0, 
-                                 double x1, double y1, double x2, double y2, double x3, double y3,
-                                 double& a, double& b, double& c)
+bool point_in_triangle_2d(double x0, double y0, 
+                          double x1, double y1, double x2, double y2, double x3, double y3,
+                          double& a, double& b, double& c)
 {
    x1-=x0; x2-=x0; x3-=x0;
    y1-=y0; y2-=y0; y3-=y0;
@@ -115,53 +399,220 @@ static bool point_in_triangle_2d(double x0, double y0,
    return true;
 }
 
-void make_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
-                     const Vec3f &origin, float dx, int ni, int nj, int nk,
-                     Array3f &phi, const int exact_band)
+// cells within exact_band of triangle t's bounding box, clamped to the grid
+static void band_box(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                     unsigned int t, const Vec3f &origin, float dx, const int exact_band,
+                     const Vec3i &size, Vec3i &lo, Vec3i &hi)
 {
-   phi.resize(ni, nj, nk);
-   phi.assign((ni+nj+nk)*dx); // upper bound on distance
-   Array3i closest_tri(ni, nj, nk, -1);
-   Array3i intersection_count(ni, nj, nk, 0); // intersection_count(i,j,k) is # of tri intersections in (i-1,i]x{j}x{k}
-   // we begin by initializing distances near the mesh, and figuring out intersection counts
-   Vec3f ijkmin, ijkmax;
-   for(unsigned int t=0; t<tri.size(); ++t){
-     unsigned int p, q, r; assign(tri[t], p, q, r);
-     // coordinates in grid to high precision
-      double fip=((double)x[p][0]-origin[0])/dx, fjp=((double)x[p][1]-origin[1])/dx, fkp=((double)x[p][2]-origin[2])/dx;
-      double fiq=((double)x[q][0]-origin[0])/dx, fjq=((double)x[q][1]-origin[1])/dx, fkq=((double)x[q][2]-origin[2])/dx;
-      double fir=((double)x[r][0]-origin[0])/dx, fjr=((double)x[r][1]-origin[1])/dx, fkr=((double)x[r][2]-origin[2])/dx;
-      // do distances nearby
-      int i0=clamp(int(min(fip,fiq,fir))-exact_band, 0, ni-1), i1=clamp(int(max(fip,fiq,fir))+exact_band+1, 0, ni-1);
-      int j0=clamp(int(min(fjp,fjq,fjr))-exact_band, 0, nj-1), j1=clamp(int(max(fjp,fjq,fjr))+exact_band+1, 0, nj-1);
-      int k0=clamp(int(min(fkp,fkq,fkr))-exact_band, 0, nk-1), k1=clamp(int(max(fkp,fkq,fkr))+exact_band+1, 0, nk-1);
-      for(int k=k0; k<=k1; ++k) for(int j=j0; j<=j1; ++j) for(int i=i0; i<=i1; ++i){
-         Vec3f gx(i*dx+origin[0], j*dx+origin[1], k*dx+origin[2]);
-         float d=point_triangle_distance(gx, x[p], x[q], x[r]);
-         if(d<phi(i,j,k)){
-            phi(i,j,k)=d;
+   unsigned int p, q, r; assign(tri[t], p, q, r);
+   for(int d=0; d<3; ++d){
+      // coordinates in grid to high precision
+      double fp=((double)x[p][d]-origin[d])/dx, fq=((double)x[q][d]-origin[d])/dx, fr=((double)x[r][d]-origin[d])/dx;
+      lo[d]=clamp(int(min(fp,fq,fr))-exact_band, 0, size[d]-1);
+      hi[d]=clamp(int(max(fp,fq,fr))+exact_band+1, 0, size[d]-1);
+   }
+}
+
+// grid rows (j,k) whose x-ray may cross triangle t, clamped to the grid
+static void crossing_rows(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                          unsigned int t, const Vec3f &origin, float dx, int nj, int nk,
+                          int &j0, int &j1, int &k0, int &k1)
+{
+   unsigned int p, q, r; assign(tri[t], p, q, r);
+   double fjp=((double)x[p][1]-origin[1])/dx, fkp=((double)x[p][2]-origin[2])/dx;
+   double fjq=((double)x[q][1]-origin[1])/dx, fkq=((double)x[q][2]-origin[2])/dx;
+   double fjr=((double)x[r][1]-origin[1])/dx, fkr=((double)x[r][2]-origin[2])/dx;
+   j0=clamp((int)std::ceil(min(fjp,fjq,fjr)), 0, nj-1);
+   j1=clamp((int)std::floor(max(fjp,fjq,fjr)), 0, nj-1);
+   k0=clamp((int)std::ceil(min(fkp,fkq,fkr)), 0, nk-1);
+   k1=clamp((int)std::floor(max(fkp,fkq,fkr)), 0, nk-1);
+}
+
+// rasterize triangle t's exact band into phi/closest_tri, within the cells lo to hi
+MULTIVERSION
+static void rasterize_band(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                           unsigned int t, const Vec3f &origin, float dx,
+                           Array3f &phi, Array3i &closest_tri, const int exact_band,
+                           const Vec3i &lo, const Vec3i &hi)
+{
+   unsigned int p, q, r; assign(tri[t], p, q, r);
+   Vec3i b0, b1;
+   band_box(tri, x, t, origin, dx, exact_band, Vec3i(phi.ni, phi.nj, phi.nk), b0, b1);
+   int i0=max(b0[0],lo[0]), i1=min(b1[0],hi[0]);
+   int j0=max(b0[1],lo[1]), j1=min(b1[1],hi[1]);
+   int k0=max(b0[2],lo[2]), k1=min(b1[2],hi[2]);
+   // distances a run of up to 64 cells along i at a time
+   float d[64];
+   for(int k=k0; k<=k1; ++k) for(int j=j0; j<=j1; ++j) for(int r0=i0; r0<=i1; r0+=64){
+      int r1=min(r0+63, i1);
+      point_triangle_distance_row(origin[0], dx, r0, r1, j*dx+origin[1], k*dx+origin[2],
+                                  x[p], x[q], x[r], d);
+      for(int i=r0; i<=r1; ++i){
+         if(d[i-r0]<phi(i,j,k)){
+            phi(i,j,k)=d[i-r0];
             closest_tri(i,j,k)=t;
          }
       }
-      // and do intersection counts
-      j0=clamp((int)std::ceil(min(fjp,fjq,fjr)), 0, nj-1);
-      j1=clamp((int)std::floor(max(fjp,fjq,fjr)), 0, nj-1);
-      k0=clamp((int)std::ceil(min(fkp,fkq,fkr)), 0, nk-1);
-      k1=clamp((int)std::floor(max(fkp,fkq,fkr)), 0, nk-1);
-      for(int k=k0; k<=k1; ++k) for(int j=j0; j<=j1; ++j){
-         double a, b, c;
-         if(point_in_triangle_2d(j, k, fjp, fkp, fjq, fkq, fjr, fkr, a, b, c)){
-            double fi=a*fip+b*fiq+c*fir; // intersection i coordinate
-            int i_interval=int(std::ceil(fi)); // intersection is in (i_interval-1,i_interval]
-            if(i_interval<0) ++intersection_count(0, j, k); // we enlarge the first interval to include everything to the -x direction
-            else if(i_interval<ni) ++intersection_count(i_interval,j,k);
-            // we ignore intersections that are beyond the +x side of the grid
-         }
+   }
+}
+
+// call crossing(i,j,k) for each x-ray crossing of triangle t in rows j in [jlo,jhi]
+// and k in [klo,khi] of an ni x nj x nk grid, where the crossing is in (i-1,i]
+template<class F>
+static void for_each_crossing(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                              unsigned int t, const Vec3f &origin, float dx, int ni, int nj, int nk,
+                              int jlo, int jhi, int klo, int khi, F crossing)
+{
+   unsigned int p, q, r; assign(tri[t], p, q, r);
+   // coordinates in grid to high precision
+   double fip=((double)x[p][0]-origin[0])/dx, fjp=((double)x[p][1]-origin[1])/dx, fkp=((double)x[p][2]-origin[2])/dx;
+   double fiq=((double)x[q][0]-origin[0])/dx, fjq=((double)x[q][1]-origin[1])/dx, fkq=((double)x[q][2]-origin[2])/dx;
+   double fir=((double)x[r][0]-origin[0])/dx, fjr=((double)x[r][1]-origin[1])/dx, fkr=((double)x[r][2]-origin[2])/dx;
+   int j0, j1, k0, k1;
+   crossing_rows(tri, x, t, origin, dx, nj, nk, j0, j1, k0, k1);
+   j0=max(j0,jlo); j1=min(j1,jhi);
+   k0=max(k0,klo); k1=min(k1,khi);
+   // the test stays scalar: point_in_triangle_2d usually exits after its first
+   // orientation, and inside and outside points come in runs along j, so its branches
+   // predict well.  evaluating all three areas across j (in double, or in float with
+   // an error bound to cull outside points) was measured 10-50% slower on this loop
+   for(int k=k0; k<=k1; ++k) for(int j=j0; j<=j1; ++j){
+      double a, b, c;
+      if(point_in_triangle_2d(j, k, fjp, fkp, fjq, fkq, fjr, fkr, a, b, c)){
+         double fi=a*fip+b*fiq+c*fir; // intersection i coordinate
+         int i_interval=int(std::ceil(fi)); // intersection is in (i_interval-1,i_interval]
+         if(i_interval<0) crossing(0, j, k); // we enlarge the first interval to include everything to the -x direction
+         else if(i_interval<ni) crossing(i_interval, j, k);
+         // we ignore intersections that are beyond the +x side of the grid
       }
    }
-   // and now we fill in the rest of the distances with fast sweeping
-   for(unsigned int pass=0; pass<2; ++pass){
-      sweep(tri, x, phi, closest_tri, origin, dx, +1, +1, +1);
+}
+
+// add triangle t's x-ray crossings to intersection_count, for rows j in [jlo,jhi]
+// and k in [klo,khi]
+static void rasterize_crossings(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                                unsigned int t, const Vec3f &origin, float dx,
+                                Array3i &intersection_count, int jlo, int jhi, int klo, int khi)
+{
+   for_each_crossing(tri, x, t, origin, dx, intersection_count.ni, intersection_count.nj, intersection_count.nk,
+                     jlo, jhi, klo, khi, [&](int i, int j, int k){ ++intersection_count(i,j,k); });
+}
+
+// one x-ray crossing of an object's surface, in (i-1,i] on row j+nj*k
+struct ObjectCrossing
+{
+   long long row;
+   int i, object;
+   bool operator<(const ObjectCrossing &c) const
+   { return row<c.row || (row==c.row && i<c.i); }
+};
+
+// rasterize the x-ray crossings of triangles first to tri.size()-1 in parallel:
+// triangles are binned into blocks of rows with a CSRHashGrid3, and one thread fills
+// each block.  Crossings are counted in intersection_count, or if crossings is given,
+// listed there tagged with the object of their triangle (tri_object) and sorted along
+// the rows, for unions of objects
+static void rasterize_all_crossings(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                                    const Vec3f &origin, float dx, const Vec3i &size, int first,
+                                    Array3i &intersection_count, const std::vector<int> *tri_object=nullptr,
+                                    std::vector<ObjectCrossing> *crossings=nullptr)
+{
+   const int block=init_block;
+   int n=tri.size()-first;
+   std::vector<Vec3i> row_lo(n), row_hi(n);
+   std::vector<int> ids(n);
+   #pragma omp parallel for schedule(static)
+   for(int b=0; b<n; ++b){
+      int t=first+b;
+      ids[b]=t;
+      int j0, j1, k0, k1;
+      crossing_rows(tri, x, t, origin, dx, size[1], size[2], j0, j1, k0, k1);
+      if(j0<=j1 && k0<=k1){
+         row_lo[b]=Vec3i(0, j0/block, k0/block); row_hi[b]=Vec3i(0, j1/block, k1/block);
+      }else{
+         row_lo[b]=Vec3i(0,0,0); row_hi[b]=Vec3i(-1,-1,-1); // no rows
+      }
+   }
+   CSRHashGrid3<int> rows;
+   rows.build_cells(row_lo, row_hi, ids);
+   std::vector<std::vector<ObjectCrossing> > block_crossings(crossings ? rows.num_cells() : 0);
+   #pragma omp parallel for schedule(dynamic)
+   for(int c=0; c<(int)rows.num_cells(); ++c){
+      int j0=block*rows.cells[c][1], k0=block*rows.cells[c][2];
+      for(const int *t=rows.cell_begin(c); t!=rows.cell_end(c); ++t){
+         if(crossings){
+            std::vector<ObjectCrossing> &list=block_crossings[c];
+            int object=(*tri_object)[*t];
+            for_each_crossing(tri, x, *t, origin, dx, size[0], size[1], size[2], j0, j0+block-1, k0, k0+block-1,
+                              [&](int i, int j, int k){
+               ObjectCrossing oc={j+(long long)size[1]*k, i, object};
+               list.push_back(oc);
+            });
+         }else
+            rasterize_crossings(tri, x, *t, origin, dx, intersection_count, j0, j0+block-1, k0, k0+block-1);
+      }
+   }
+   if(!crossings) return;
+   size_t total=0;
+   for(auto &list: block_crossings) total+=list.size();
+   crossings->clear();
+   crossings->reserve(total);
+   for(auto &list: block_crossings) crossings->insert(crossings->end(), list.begin(), list.end());
+   std::sort(crossings->begin(), crossings->end());
+}
+
+// rasterize the exact band (skipped if exact_band<0) and x-ray crossings of triangles
+// first to tri.size()-1 in parallel: triangles are binned into blocks of cells with a
+// CSRHashGrid3, and one thread fills each block.  A block visits its triangles in index
+// order, so the result is the same as rasterizing them in turn.  Given initialized,
+// blocks are initialized as they are first reached.  Crossings are skipped if
+// intersection_count is empty (unsigned distances, or unions of objects, whose
+// crossings apply_signs lists instead).
+static void rasterize_all(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                          const Vec3f &origin, float dx,
+                          Array3f &phi, Array3i &closest_tri, Array3i &intersection_count,
+                          const int exact_band, int first=0, Array3uc *initialized=nullptr)
+{
+   const int block=init_block;
+   int n=tri.size()-first;
+   Vec3i size(phi.ni, phi.nj, phi.nk);
+   if(exact_band>=0){
+      std::vector<Vec3i> band_lo(n), band_hi(n);
+      std::vector<int> ids(n);
+      #pragma omp parallel for schedule(static)
+      for(int b=0; b<n; ++b){
+         int t=first+b;
+         ids[b]=t;
+         Vec3i lo, hi;
+         band_box(tri, x, t, origin, dx, exact_band, size, lo, hi);
+         band_lo[b]=lo/block; band_hi[b]=hi/block;
+      }
+      CSRHashGrid3<int> blocks;
+      blocks.build_cells(band_lo, band_hi, ids);
+      #pragma omp parallel for schedule(dynamic)
+      for(int c=0; c<(int)blocks.num_cells(); ++c){
+         Vec3i lo=block*blocks.cells[c], hi=lo+Vec3i(block-1,block-1,block-1);
+         if(initialized && !(*initialized)(blocks.cells[c][0], blocks.cells[c][1], blocks.cells[c][2]))
+            initialize_block(phi, closest_tri, *initialized, dx, blocks.cells[c]);
+         for(const int *t=blocks.cell_begin(c); t!=blocks.cell_end(c); ++t)
+            rasterize_band(tri, x, *t, origin, dx, phi, closest_tri, exact_band, lo, hi);
+      }
+   }
+   if(intersection_count.a.size()>0)
+      rasterize_all_crossings(tri, x, origin, dx, size, first, intersection_count);
+}
+
+// fill in the rest of the distances with passes of fast sweeping in all 8 directions
+// (initializing what is left as it goes, given initialized)
+static void sweep_all(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                      Array3f &phi, Array3i &closest_tri, const Vec3f &origin, float dx,
+                      Array3uc *initialized=nullptr, unsigned int passes=2)
+{
+   for(unsigned int pass=0; pass<passes; ++pass){
+      if(pass==0 && initialized)
+         sweep_initializing(tri, x, phi, closest_tri, origin, dx, *initialized);
+      else
+         sweep(tri, x, phi, closest_tri, origin, dx, +1, +1, +1);
       sweep(tri, x, phi, closest_tri, origin, dx, -1, -1, -1);
       sweep(tri, x, phi, closest_tri, origin, dx, +1, +1, -1);
       sweep(tri, x, phi, closest_tri, origin, dx, -1, -1, +1);
@@ -170,15 +621,394 @@ void make_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x
       sweep(tri, x, phi, closest_tri, origin, dx, +1, -1, -1);
       sweep(tri, x, phi, closest_tri, origin, dx, -1, +1, +1);
    }
-   // then figure out signs (inside/outside) from intersection counts
-   for(int k=0; k<nk; ++k) for(int j=0; j<nj; ++j){
-      int total_count=0;
-      for(int i=0; i<ni; ++i){
-         total_count+=intersection_count(i,j,k);
-         if(total_count%2==1){ // if parity of intersections so far is odd,
-            phi(i,j,k)=-phi(i,j,k); // we are inside the mesh
+}
+
+// blocks of block^3 cells that may hold cells within max_distance of the mesh.  Every
+// surface point is within sqrt(3)*dx of the corners of its cell, which the exact band
+// (of at least one cell) has evaluated, so blocks holding such cells are dilated by
+// max_distance plus that margin.
+static void near_blocks(const Array3f &phi, float dx, int block, float max_distance,
+                        std::vector<Vec3i> &blocks)
+{
+   Vec3i nb((phi.ni+block-1)/block, (phi.nj+block-1)/block, (phi.nk+block-1)/block);
+   Array3uc mark(nb[0], nb[1], nb[2], (unsigned char)0);
+   float surface=std::sqrt(3.f)*dx;
+   for(int k=0; k<phi.nk; ++k) for(int j=0; j<phi.nj; ++j) for(int i=0; i<phi.ni; ++i)
+      if(phi(i,j,k)<=surface) mark(i/block, j/block, k/block)=1;
+   // dilate one axis at a time
+   int r=(int(std::ceil((max_distance+surface)/dx))+block-1)/block;
+   for(int d=0; d<3; ++d){
+      Array3uc dilated(nb[0], nb[1], nb[2], (unsigned char)0);
+      for(int k=0; k<nb[2]; ++k) for(int j=0; j<nb[1]; ++j) for(int i=0; i<nb[0]; ++i){
+         if(!mark(i,j,k)) continue;
+         Vec3i c(i,j,k);
+         int c0=max(c[d]-r, 0), c1=min(c[d]+r, nb[d]-1);
+         for(c[d]=c0; c[d]<=c1; ++c[d]) dilated(c[0],c[1],c[2])=1;
+      }
+      mark=dilated;
+   }
+   blocks.clear();
+   for(int k=0; k<nb[2]; ++k) for(int j=0; j<nb[1]; ++j) for(int i=0; i<nb[0]; ++i)
+      if(mark(i,j,k)) blocks.push_back(Vec3i(i,j,k));
+}
+
+// fast sweeping as in sweep_all, but only over the blocks near the mesh.  A neighbour
+// more than max_distance+sqrt(3)*dx from its triangle cannot bring a cell within
+// max_distance, so it is not checked.
+static void sweep_near(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                       Array3f &phi, Array3i &closest_tri, const Vec3f &origin, float dx,
+                       float max_distance)
+{
+   const int block=8;
+   float limit=max_distance+std::sqrt(3.f)*dx;
+   std::vector<Vec3i> blocks;
+   near_blocks(phi, dx, block, max_distance, blocks);
+   for(unsigned int pass=0; pass<2; ++pass){
+      sweep_blocks(tri, x, phi, closest_tri, origin, dx, blocks, block, +1, +1, +1, limit);
+      sweep_blocks(tri, x, phi, closest_tri, origin, dx, blocks, block, -1, -1, -1, limit);
+      sweep_blocks(tri, x, phi, closest_tri, origin, dx, blocks, block, +1, +1, -1, limit);
+      sweep_blocks(tri, x, phi, closest_tri, origin, dx, blocks, block, -1, -1, +1, limit);
+      sweep_blocks(tri, x, phi, closest_tri, origin, dx, blocks, block, +1, -1, +1, limit);
+      sweep_blocks(tri, x, phi, closest_tri, origin, dx, blocks, block, -1, +1, -1, limit);
+      sweep_blocks(tri, x, phi, closest_tri, origin, dx, blocks, block, +1, -1, -1, limit);
+      sweep_blocks(tri, x, phi, closest_tri, origin, dx, blocks, block, -1, +1, +1, limit);
+   }
+}
+
+// fill in the rest of the distances by marching closest triangles outward from the
+// exact band in (approximately) increasing distance order, using buckets of width dx/2
+static void march(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                  Array3f &phi, Array3i &closest_tri, const Vec3f &origin, float dx,
+                  float stop_distance)
+{
+   int ni=phi.ni, nj=phi.nj, nk=phi.nk;
+   float bucket_width=0.5f*dx;
+   float max_distance=(ni+nj+nk)*dx;
+   if(stop_distance>0 && stop_distance<max_distance) max_distance=stop_distance;
+   int num_buckets=int(max_distance/bucket_width)+2;
+   std::vector<std::vector<int> > buckets(num_buckets);
+   Array3uc queued(ni, nj, nk, (unsigned char)0);
+   // seed with the exact band
+   for(int n=0; n<(int)phi.a.size(); ++n){
+      if(closest_tri.a[n]>=0){
+         buckets[min(int(phi.a[n]/bucket_width), num_buckets-1)].push_back(n);
+         queued.a[n]=1;
+      }
+   }
+   for(int b=0; b<num_buckets; ++b){
+      if(b*bucket_width>max_distance) break;
+      // a bucket can grow while we process it, so index rather than iterate
+      for(size_t e=0; e<buckets[b].size(); ++e){
+         int n=buckets[b][e];
+         if(!queued.a[n]) continue; // stale duplicate of a cell already processed
+         queued.a[n]=0;
+         int t=closest_tri.a[n];
+         unsigned int p, q, r; assign(tri[t], p, q, r);
+         int i=n%ni, j=(n/ni)%nj, k=n/(ni*nj);
+         for(int dk=-1; dk<=1; ++dk) for(int dj=-1; dj<=1; ++dj) for(int di=-1; di<=1; ++di){
+            int i1=i+di, j1=j+dj, k1=k+dk;
+            if(i1<0 || i1>=ni || j1<0 || j1>=nj || k1<0 || k1>=nk) continue;
+            if(closest_tri(i1,j1,k1)==t) continue;
+            Vec3f gx(i1*dx+origin[0], j1*dx+origin[1], k1*dx+origin[2]);
+            float d=point_triangle_distance(gx, x[p], x[q], x[r]);
+            if(d<phi(i1,j1,k1)){
+               phi(i1,j1,k1)=d;
+               closest_tri(i1,j1,k1)=t;
+               // never file behind the bucket being processed
+               int b1=clamp(int(d/bucket_width), b, num_buckets-1);
+               int n1=i1+ni*(j1+nj*k1);
+               buckets[b1].push_back(n1);
+               queued.a[n1]=1;
+            }
+         }
+      }
+      std::vector<int>().swap(buckets[b]);
+   }
+}
+
+// 1D squared distance transform of sampled function f (Felzenszwalb and Huttenlocher):
+// d[q] = min_p (q-p)^2 + f[p], with feat_out[q] = feat[argmin p].  Infinite f[p] are not
+// sites.  v and z are scratch arrays of size n and n+1.
+static void distance_transform_1d(const float *f, const int *feat, int n, float *d, int *feat_out,
+                                  int *v, double *z)
+{
+   const float inf=std::numeric_limits<float>::infinity();
+   int k=-1;
+   double s=0;
+   for(int q=0; q<n; ++q){
+      if(f[q]==inf) continue;
+      while(k>=0){
+         s=((f[q]+(double)q*q)-(f[v[k]]+(double)v[k]*v[k]))/(2.0*q-2.0*v[k]);
+         if(s<=z[k]) --k;
+         else break;
+      }
+      if(k<0){
+         k=0; v[0]=q; z[0]=-inf; z[1]=inf;
+      }else{
+         ++k; v[k]=q; z[k]=s; z[k+1]=inf;
+      }
+   }
+   if(k<0){
+      for(int q=0; q<n; ++q){ d[q]=inf; feat_out[q]=feat[q]; }
+      return;
+   }
+   for(int q=0, j=0; q<n; ++q){
+      while(z[j+1]<q) ++j;
+      d[q]=sqr(float(q-v[j]))+f[v[j]];
+      feat_out[q]=feat[v[j]];
+   }
+}
+
+// fill in the rest of the distances from the exact band cell p minimizing |q-p|^2+phi(p)^2,
+// found by separable squared distance transforms along x, then y, then z (each fully
+// parallel over lines).  that is only a guess at the closest triangle (exact when q-p is
+// normal to the surface), off by up to about dx near corners; the wider the band, the
+// better the guess
+static void distance_transform(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                               Array3f &phi, Array3i &closest_tri, const Vec3f &origin, float dx,
+                               float band_distance)
+{
+   int ni=phi.ni, nj=phi.nj, nk=phi.nk;
+   const float inf=std::numeric_limits<float>::infinity();
+   // squared distance (in cells) via the nearest band cell so far; only cells within
+   // band_distance are seeds, since further ones may not hold the closest triangle
+   Array3f sq;
+   allocate_grid(sq, ni, nj, nk, inf);
+   for(int n=0; n<(int)sq.a.size(); ++n){
+      sq.a[n]=closest_tri.a[n]>=0 && phi.a[n]<=band_distance ? sqr(phi.a[n]/dx) : inf;
+      if(sq.a[n]==inf) closest_tri.a[n]=-1;
+   }
+   int dims[3]={ni, nj, nk}, strides[3]={1, ni, ni*nj};
+   for(int axis=0; axis<3; ++axis){
+      int n=dims[axis], stride=strides[axis];
+      int a1=(axis+1)%3, a2=(axis+2)%3;
+      int num_lines=dims[a1]*dims[a2];
+      #pragma omp parallel
+      {
+         std::vector<float> f(n), d(n);
+         std::vector<int> feat(n), feat_out(n), v(n);
+         std::vector<double> z(n+1);
+         #pragma omp for schedule(static)
+         for(int line=0; line<num_lines; ++line){
+            int c[3];
+            c[axis]=0; c[a1]=line%dims[a1]; c[a2]=line/dims[a1];
+            int start=c[0]+ni*(c[1]+nj*c[2]);
+            for(int q=0; q<n; ++q){
+               f[q]=sq.a[start+q*stride];
+               feat[q]=closest_tri.a[start+q*stride];
+            }
+            distance_transform_1d(&f[0], &feat[0], n, &d[0], &feat_out[0], &v[0], &z[0]);
+            for(int q=0; q<n; ++q){
+               sq.a[start+q*stride]=d[q];
+               closest_tri.a[start+q*stride]=feat_out[q];
+            }
+         }
+      }
+   }
+   // evaluate the triangle found; band cells already hold their exact values
+   #pragma omp parallel for schedule(static)
+   for(int k=0; k<nk; ++k) for(int j=0; j<nj; ++j) for(int i=0; i<ni; ++i){
+      int t=closest_tri(i,j,k);
+      if(t<0 || phi(i,j,k)<=band_distance) continue;
+      unsigned int p, q, r; assign(tri[t], p, q, r);
+      Vec3f gx(i*dx+origin[0], j*dx+origin[1], k*dx+origin[2]);
+      phi(i,j,k)=point_triangle_distance(gx, x[p], x[q], x[r]);
+   }
+}
+
+// figure out signs (inside/outside) from intersection counts, and in the same pass fill
+// in any requested channels from each cell's closest triangle
+MULTIVERSION
+static void apply_signs(const Array3i &intersection_count, Array3f &phi,
+                        const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                        const Array3i &closest_tri, const Vec3f &origin, float dx,
+                        const std::vector<int> *tri_object,
+                        LevelSetChannels *channels, LevelSetSink *sink,
+                        bool unsigned_distance=false, float shell=0)
+{
+   bool want_points=channels && channels->closest_points;
+   bool want_gradients=channels && channels->gradients;
+   bool want_objects=channels && channels->objects;
+   for(int c=0; c<3; ++c){
+      if(want_points) allocate_grid(channels->closest[c], phi.ni, phi.nj, phi.nk, 0.f);
+      if(want_gradients) allocate_grid(channels->gradient[c], phi.ni, phi.nj, phi.nk, 0.f);
+   }
+   if(want_objects) allocate_grid(channels->object, phi.ni, phi.nj, phi.nk, -1);
+   // with several objects a cell is inside if it is inside any of them, so the
+   // parity is tracked per object from a list of crossings instead of the counts
+   std::vector<ObjectCrossing> crossings;
+   std::vector<char> inside;
+   if(tri_object && !unsigned_distance){
+      Array3i no_counts;
+      rasterize_all_crossings(tri, x, origin, dx, Vec3i(phi.ni, phi.nj, phi.nk), 0, no_counts,
+                              tri_object, &crossings);
+      inside.assign(tri_object->empty() ? 0 : *std::max_element(tri_object->begin(), tri_object->end())+1, 0);
+   }
+   // unsigned distances only get the shell taken off, before the sink sees |phi|
+   if(unsigned_distance && shell>0){
+      #pragma omp parallel for schedule(static)
+      for(int k=0; k<phi.nk; ++k) for(int j=0; j<phi.nj; ++j) for(int i=0; i<phi.ni; ++i)
+         phi(i,j,k)-=shell;
+   }
+   size_t next=0;
+   if(sink) sink->begin(phi, closest_tri, channels);
+   for(int k=0; k<phi.nk; ++k){
+      for(int j=0; j<phi.nj; ++j){
+         int total_count=0, inside_count=0;
+         long long row=j+(long long)phi.nj*k;
+         size_t row_begin=next;
+         for(int i=0; i<phi.ni; ++i){
+            if(unsigned_distance){
+               // no sign
+            }else if(tri_object){
+               for(; next<crossings.size() && crossings[next].row==row && crossings[next].i==i; ++next){
+                  char &in=inside[crossings[next].object];
+                  in^=1;
+                  inside_count+=in ? 1 : -1;
+               }
+               if(inside_count>0) phi(i,j,k)=-phi(i,j,k);
+            }else{
+               total_count+=intersection_count(i,j,k);
+               if(total_count%2==1){ // if parity of intersections so far is odd,
+                  phi(i,j,k)=-phi(i,j,k); // we are inside the mesh
+               }
+            }
+            int t=closest_tri(i,j,k);
+            if(want_objects && t>=0) channels->object(i,j,k)=tri_object ? (*tri_object)[t] : 0;
+            if(!(want_points || want_gradients) || t<0) continue;
+            unsigned int p, q, r; assign(tri[t], p, q, r);
+            Vec3f gx(i*dx+origin[0], j*dx+origin[1], k*dx+origin[2]);
+            Vec3f cp=point_triangle_closest(gx, x[p], x[q], x[r]);
+            if(want_points){
+               for(int c=0; c<3; ++c) channels->closest[c](i,j,k)=cp[c];
+            }
+            if(want_gradients){
+               // grad phi points away from the surface outside and towards it inside
+               // (always away for unsigned distances and shells); on the surface
+               // itself fall back to the triangle normal
+               Vec3f g=gx-cp;
+               float m=mag(g);
+               if(m>1e-6f*dx) g*=(phi(i,j,k)<0 && !unsigned_distance ? -1.f : 1.f)/m;
+               else g=normalized(cross(x[q]-x[p], x[r]-x[p]));
+               for(int c=0; c<3; ++c) channels->gradient[c](i,j,k)=g[c];
+            }
+         }
+         for(size_t c=row_begin; c<next; ++c) inside[crossings[c].object]=0;
+      }
+      if(sink) sink->finished_layers(k, k+1);
+   }
+}
+
+void make_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                     const Vec3f &origin, float dx, int ni, int nj, int nk,
+                     Array3f &phi, const int exact_band)
+{
+   Array3i closest_tri;
+   make_level_set3(tri, x, origin, dx, ni, nj, nk, phi, closest_tri, exact_band);
+}
+
+void make_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                     const Vec3f &origin, float dx, int ni, int nj, int nk,
+                     Array3f &phi, Array3i &closest_tri, const int exact_band)
+{
+   LevelSetOptions opts;
+   opts.exact_band=exact_band;
+   make_level_set3(tri, x, origin, dx, ni, nj, nk, phi, closest_tri, opts);
+}
+
+void make_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                     const Vec3f &origin, float dx, int ni, int nj, int nk,
+                     Array3f &phi, Array3i &closest_tri, const LevelSetOptions &opts,
+                     LevelSetChannels *channels, LevelSetSink *sink)
+{
+   Array3i intersection_count;
+   Array3uc initialized;
+   begin_level_set3(ni, nj, nk, dx, phi, closest_tri, intersection_count, initialized,
+                    !opts.unsigned_distance && !opts.tri_object);
+   // we begin by initializing distances near the mesh, and figuring out intersection counts
+   rasterize_level_set3(tri, x, 0, origin, dx, phi, closest_tri, intersection_count, initialized, opts.exact_band);
+   finish_level_set3(tri, x, origin, dx, phi, closest_tri, intersection_count, initialized, opts, channels, sink);
+}
+
+void begin_level_set3(int ni, int nj, int nk, float dx,
+                      Array3f &phi, Array3i &closest_tri, Array3i &intersection_count,
+                      Array3uc &initialized, bool count_crossings)
+{
+   // pages first touched in parallel by layer (see grid_memory.h), but the values are
+   // only set block by block when needed
+   allocate_grid_pages(phi, ni, nj, nk, (ni+nj+nk)*dx);
+   allocate_grid_pages(closest_tri, ni, nj, nk, -1);
+   initialized.assign((ni+init_block-1)/init_block, (nj+init_block-1)/init_block,
+                      (nk+init_block-1)/init_block, (unsigned char)0);
+   // most rows are never crossed, and their zero pages are never written; unsigned
+   // distances and unions of objects need no counts at all
+   if(!count_crossings) intersection_count.clear();
+   else allocate_zeroed_grid(intersection_count, ni, nj, nk); // intersection_count(i,j,k) is # of tri intersections in (i-1,i]x{j}x{k}
+}
+
+void rasterize_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x, int first,
+                          const Vec3f &origin, float dx, Array3f &phi, Array3i &closest_tri,
+                          Array3i &intersection_count, Array3uc &initialized, const int exact_band)
+{
+   rasterize_all(tri, x, origin, dx, phi, closest_tri, intersection_count, exact_band, first, &initialized);
+}
+
+void finish_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                       const Vec3f &origin, float dx, Array3f &phi, Array3i &closest_tri,
+                       const Array3i &intersection_count, Array3uc &initialized,
+                       const LevelSetOptions &opts, LevelSetChannels *channels, LevelSetSink *sink)
+{
+   // fill in the rest of the distances
+   bool truncate=opts.max_distance>0;
+   bool full_sweep=opts.engine!=ENGINE_MARCH && opts.engine!=ENGINE_EDT && !(truncate && opts.exact_band>=1);
+   if(!full_sweep) initialize_remaining(phi, closest_tri, initialized, dx);
+   if(opts.engine==ENGINE_MARCH){
+      float stop=opts.stop_distance;
+      if(truncate && (stop<=0 || stop>opts.max_distance)) stop=opts.max_distance;
+      march(tri, x, phi, closest_tri, origin, dx, stop);
+   }else if(opts.engine==ENGINE_EDT){
+      distance_transform(tri, x, phi, closest_tri, origin, dx, opts.exact_band*dx);
+      // the transform only finds a triangle near the closest (see distance_transform);
+      // one pass of sweeping corrects them
+      sweep_all(tri, x, phi, closest_tri, origin, dx, nullptr, 1);
+   }else if(truncate && opts.exact_band>=1)
+      sweep_near(tri, x, phi, closest_tri, origin, dx, opts.max_distance);
+   else
+      sweep_all(tri, x, phi, closest_tri, origin, dx, &initialized);
+   if(truncate){
+      // cells never reached keep the upper bound, and lose their triangle beyond the limit
+      for(size_t n=0; n<phi.a.size(); ++n){
+         if(phi.a[n]>opts.max_distance){
+            phi.a[n]=opts.max_distance;
+            closest_tri.a[n]=-1;
          }
       }
    }
+   // then figure out signs (inside/outside) from intersection counts
+   apply_signs(intersection_count, phi, tri, x, closest_tri, origin, dx, opts.tri_object, channels, sink,
+               opts.unsigned_distance, opts.shell);
 }
 
+void update_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                       const Vec3f &origin, float dx, Array3f &phi, Array3i &closest_tri)
+{
+   int ni=closest_tri.ni, nj=closest_tri.nj, nk=closest_tri.nk;
+   phi.resize(ni, nj, nk);
+   Array3i intersection_count(ni, nj, nk, 0);
+   // re-evaluate every cell's previous closest triangle at the new vertex positions
+   float upper_bound=(ni+nj+nk)*dx;
+   for(int k=0; k<nk; ++k) for(int j=0; j<nj; ++j) for(int i=0; i<ni; ++i){
+      int t=closest_tri(i,j,k);
+      if(t>=0){
+         unsigned int p, q, r; assign(tri[t], p, q, r);
+         Vec3f gx(i*dx+origin[0], j*dx+origin[1], k*dx+origin[2]);
+         phi(i,j,k)=point_triangle_distance(gx, x[p], x[q], x[r]);
+      }else
+         phi(i,j,k)=upper_bound;
+   }
+   // crossings still need every triangle, but skip the exact band rasterization
+   rasterize_all(tri, x, origin, dx, phi, closest_tri, intersection_count, -1);
+   // sweeping repairs candidates that are no longer the closest
+   sweep_all(tri, x, phi, closest_tri, origin, dx);
+   apply_signs(intersection_count, phi, tri, x, closest_tri, origin, dx, nullptr, nullptr, nullptr);
+}
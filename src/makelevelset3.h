@@ -4,6 +4,24 @@
 #include "array3.h"
 #include "vec.h"
 
+// find distance x0 is from triangle x1-x2-x3
+float point_triangle_distance(const Vec3f &x0, const Vec3f &x1, const Vec3f &x2, const Vec3f &x3);
+
+// point_triangle_distance from each of the points (x0+i*dx, y0, z0), i0<=i<=i1, into
+// d[i-i0]; vectorized across the points, with identical results
+void point_triangle_distance_row(float x0, float dx, int i0, int i1, float y0, float z0,
+                                 const Vec3f &x1, const Vec3f &x2, const Vec3f &x3, float *d);
+
+// find the point on triangle x1-x2-x3 closest to x0
+Vec3f point_triangle_closest(const Vec3f &x0, const Vec3f &x1, const Vec3f &x2, const Vec3f &x3);
+
+// robust test of (x0,y0) in the triangle (x1,y1)-(x2,y2)-(x3,y3), with ties broken by
+// simulation of simplicity so a point on a shared edge is in exactly one triangle
+// if true is returned, the barycentric coordinates are set in a,b,c.
+bool point_in_triangle_2d(double x0, double y0,
+                          double x1, double y1, double x2, double y2, double x3, double y3,
+                          double& a, double& b, double& c);
+
 // tri is a list of triangles in the mesh, and x is the positions of the vertices
 // absolute distances will be nearly correct for triangle soup, but a closed mesh is
 // needed for accurate signs. Distances for all grid cells within exact_band cells of
@@ -13,4 +31,117 @@ void make_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x
                      const Vec3f &origin, float dx, int nx, int ny, int nz,
                      Array3f &phi, const int exact_band=1);
 
+// As above, but also returns the index of the (approximately) closest triangle for
+// every grid cell, which can be used to warm-start update_level_set3.
+void make_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                     const Vec3f &origin, float dx, int nx, int ny, int nz,
+                     Array3f &phi, Array3i &closest_tri, const int exact_band=1);
+
+// How distances are extended away from the exact band.
+enum LevelSetEngine {
+   ENGINE_SWEEP, // 2x8 fast sweeping passes over the whole grid
+   ENGINE_MARCH, // closest triangles marched outward in distance order (Dial's buckets)
+   ENGINE_EDT    // separable Euclidean distance transform from the exact band guessing
+                 // each cell's closest triangle, then 1x8 sweeping passes to correct the
+                 // guesses (most accurate with exact_band>=2)
+};
+
+struct LevelSetOptions
+{
+   int exact_band;
+   LevelSetEngine engine;
+   // ENGINE_MARCH stops once it reaches this distance (<=0 for no limit); cells further
+   // out keep the upper bound (nx+ny+nz)*dx in magnitude.
+   float stop_distance;
+   // if >0, distances are truncated to this (a TSDF): cells further from the mesh get
+   // +-max_distance and no closest triangle.  ENGINE_SWEEP then only sweeps blocks of
+   // cells near the mesh (given exact_band>=1) and ENGINE_MARCH stops at max_distance,
+   // so the work scales with the volume of the band; ENGINE_EDT still covers the
+   // whole grid.
+   float max_distance;
+   // if given, the object (0, 1, ...) each triangle belongs to: the mesh is a union of
+   // closed objects, which may overlap, and a cell is inside if it is inside any of
+   // them.  Distances are to the nearest surface of any object, including parts buried
+   // inside another object, so within overlaps |phi| can be smaller than in the
+   // minimum of the separate fields.
+   const std::vector<int> *tri_object;
+   // if set, phi is the unsigned distance to the triangles, for open surfaces and
+   // triangle soups where inside and outside mean nothing: no x-ray crossings are
+   // found, and there are no intersection counts or parity pass.  phi is then
+   // |d|-shell, so shell>0 gives the signed distance of the surface thickened by
+   // shell to each side (gradients point away from the surface).
+   bool unsigned_distance;
+   float shell;
+
+   LevelSetOptions()
+      : exact_band(1), engine(ENGINE_SWEEP), stop_distance(0), max_distance(0), tri_object(0),
+        unsigned_distance(false), shell(0)
+   {}
+};
+
+// Optional per-cell outputs besides phi and closest_tri, filled in from the closest
+// triangle during the final sign pass.  Cells without a closest triangle get zeros.
+struct LevelSetChannels
+{
+   bool closest_points, gradients, objects; // which channels to compute
+   Array3f closest[3];             // components of the closest surface point
+   Array3f gradient[3];            // components of the unit gradient of phi
+   Array3i object;                 // object of the closest triangle (see tri_object), or -1
+
+   LevelSetChannels()
+      : closest_points(false), gradients(false), objects(false)
+   {}
+};
+
+// Receives the grids layer by layer as the final sign pass completes them, e.g. to
+// write them out while the rest is still being computed.
+struct LevelSetSink
+{
+   virtual ~LevelSetSink() {}
+   // called before the sign pass, when |phi| is already final
+   virtual void begin(const Array3f &phi, const Array3i &closest_tri,
+                      const LevelSetChannels *channels)=0;
+   // called in order of k once layers k0 to k1-1 of every grid are final
+   virtual void finished_layers(int k0, int k1)=0;
+};
+
+// As above, with all settings given in opts, and optionally extra output channels
+// and a sink for the finished layers.
+void make_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                     const Vec3f &origin, float dx, int nx, int ny, int nz,
+                     Array3f &phi, Array3i &closest_tri, const LevelSetOptions &opts,
+                     LevelSetChannels *channels=nullptr, LevelSetSink *sink=nullptr);
+
+// make_level_set3 in three steps, for meshes that arrive in pieces (e.g. while the
+// file is still being read).  begin_level_set3 sets up the grids; each call of
+// rasterize_level_set3 adds the exact band and crossings of triangles first to
+// tri.size()-1, leaving earlier triangles and vertices untouched; finish_level_set3
+// extends the distances from the band and applies the signs.  Rasterizing in pieces
+// gives the same result as all at once.  phi and closest_tri are not written in
+// full up front: initialized tracks which blocks of them hold their initial values,
+// and the rest are set when first reached.  Without count_crossings (unsigned
+// distances, or a union given by opts.tri_object, whose crossings finish_level_set3
+// finds per object) intersection_count is left empty, and no crossings are rasterized.
+void begin_level_set3(int nx, int ny, int nz, float dx,
+                      Array3f &phi, Array3i &closest_tri, Array3i &intersection_count,
+                      Array3uc &initialized, bool count_crossings=true);
+void rasterize_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x, int first,
+                          const Vec3f &origin, float dx, Array3f &phi, Array3i &closest_tri,
+                          Array3i &intersection_count, Array3uc &initialized, const int exact_band=1);
+void finish_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                       const Vec3f &origin, float dx, Array3f &phi, Array3i &closest_tri,
+                       const Array3i &intersection_count, Array3uc &initialized,
+                       const LevelSetOptions &opts, LevelSetChannels *channels=nullptr,
+                       LevelSetSink *sink=nullptr);
+
+// Recomputes phi after the vertices x have moved, using the closest_tri field of the
+// previous frame (same triangle list and grid) instead of the exact band rasterization.
+// Each cell's old closest triangle is re-evaluated and then repaired by fast sweeping.
+// If no vertex moved more than delta, a cell whose old closest triangle was off from
+// the true closest distance by at most e ends up within e+2*delta of exact. So cells
+// in the exact band are within 2*delta, but cells further out keep the error of the
+// sweep that first filled them.
+void update_level_set3(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                       const Vec3f &origin, float dx, Array3f &phi, Array3i &closest_tri);
+
 #endif
@@ -0,0 +1,293 @@
+#include "marching_cubes.h"
+#include "mesh_query.h"
+#include "string_tools.h"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+using std::cout;
+
+namespace {
+
+// Cube corner c is node (i,j,k) + (c&1, c>>1&1, c>>2&1).  Edge e runs along axis
+// e/4 from corner[e][0] to corner[e][1].  For each pattern of inside corners (bit
+// c set if corner c is inside) the table lists triangles as triples of edges.
+struct CubeTable {
+    int corner[12][2];
+    int num_tris[256];
+    int tri[256][12][3];
+
+    int edge(int a, int b) const {
+        for (int e=0; e<12; ++e) {
+            if ((corner[e][0] == a && corner[e][1] == b) || (corner[e][0] == b && corner[e][1] == a)) return e;
+        }
+        return -1;
+    }
+
+    // Rather than a hand-written case table, the surface in each cube is traced from
+    // its cut faces.  Walking the corners of a face counterclockwise seen from
+    // outside, the surface crosses it from the edge entering a run of inside corners
+    // to the edge leaving it (each inside corner is its own run on ambiguous faces).
+    // Every crossed edge is entered on one of its faces and left on the other, so
+    // the segments close into loops, oriented so that the fan triangles face away
+    // from the inside.
+    CubeTable() {
+        int e = 0;
+        for (int axis=0; axis<3; ++axis) {
+            for (int c=0; c<8; ++c) {
+                if (c>>axis & 1) continue;
+                corner[e][0] = c;
+                corner[e][1] = c | 1<<axis;
+                ++e;
+            }
+        }
+        for (int pattern=0; pattern<256; ++pattern) {
+            int next[12];
+            for (int n=0; n<12; ++n) next[n] = -1;
+            for (int axis=0; axis<3; ++axis) {
+                for (int side=0; side<2; ++side) {
+                    // (u, v, axis) is right handed, so (0,0), (1,0), (1,1), (0,1) in
+                    // (u, v) is counterclockwise about +axis.
+                    int u = (axis+1)%3, v = (axis+2)%3;
+                    int uv[4][2] = {{0,0}, {1,0}, {1,1}, {0,1}};
+                    int face[4];
+                    bool in[4];
+                    for (int m=0; m<4; ++m) {
+                        int n = side ? m : 3-m;
+                        face[m] = side<<axis | uv[n][0]<<u | uv[n][1]<<v;
+                        in[m] = pattern>>face[m] & 1;
+                    }
+                    for (int m=0; m<4; ++m) {
+                        if (!in[m] || in[(m+1)%4]) continue;
+                        int p = m;
+                        while (in[(p+3)%4]) p = (p+3)%4;
+                        next[edge(face[(p+3)%4], face[p])] = edge(face[m], face[(m+1)%4]);
+                    }
+                }
+            }
+            num_tris[pattern] = 0;
+            bool used[12] = {false};
+            for (int start=0; start<12; ++start) {
+                if (next[start] < 0 || used[start]) continue;
+                int loop[12], length = 0;
+                for (int n=start; !used[n]; n=next[n]) {
+                    used[n] = true;
+                    loop[length++] = n;
+                }
+                for (int t=1; t+1<length; ++t) {
+                    int *f = tri[pattern][num_tris[pattern]++];
+                    f[0] = loop[0]; f[1] = loop[t]; f[2] = loop[t+1];
+                }
+            }
+        }
+    }
+};
+
+const CubeTable &cube_table() {
+    static const CubeTable table;
+    return table;
+}
+
+}
+
+// Numbers the crossed edges owned by node layer k (its x and y edges, and its z
+// edges to the next layer if hi is given) in a fixed order starting at first, and
+// returns their count.  If ids is given it receives the number of each edge (three
+// per node, ~0u if not crossed), and if verts is given the crossing points are
+// stored from verts[first] on.
+static size_t number_edges(const float *lo, const float *hi, int ni, int nj, int k, float iso,
+                           const Vec3f &origin, float dx, size_t first, unsigned *ids, Vec3f *verts) {
+    size_t count = 0;
+    for (int j=0; j<nj; ++j) {
+        for (int i=0; i<ni; ++i) {
+            size_t n = i + (size_t)ni*j;
+            float a = lo[n];
+            float b[3] = {i+1 < ni ? lo[n+1] : a, j+1 < nj ? lo[n+ni] : a, hi ? hi[n] : a};
+            for (int axis=0; axis<3; ++axis) {
+                bool crossed = (a < iso) != (b[axis] < iso);
+                if (ids) ids[3*n+axis] = crossed ? (unsigned)(first + count) : ~0u;
+                if (!crossed) continue;
+                if (verts) {
+                    Vec3f p = origin + dx*Vec3f(i, j, k);
+                    p[axis] += dx*(iso - a)/(b[axis] - a);
+                    verts[first + count] = p;
+                }
+                ++count;
+            }
+        }
+    }
+    return count;
+}
+
+void extract_isosurface(int ni, int nj, int nk, const Vec3f &origin, float dx,
+                        const LayerReader &read_layer, float iso, Triangulation &mesh) {
+    const CubeTable &table = cube_table();
+    size_t layer = (size_t)ni*nj;
+    int num_slabs = max(1, min(64, nk/4));
+
+    // Count the vertices of each node layer, then number them in layer order.
+    std::vector<size_t> first_vertex(nk+1, 0);
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int s=0; s<num_slabs; ++s) {
+        int k0 = (int)((long long)nk*s/num_slabs), k1 = (int)((long long)nk*(s+1)/num_slabs);
+        std::vector<float> lo(layer), hi(layer);
+        read_layer(k0, lo.data());
+        for (int k=k0; k<k1; ++k) {
+            if (k+1 < nk) read_layer(k+1, hi.data());
+            first_vertex[k+1] = number_edges(lo.data(), k+1 < nk ? hi.data() : nullptr,
+                                             ni, nj, k, iso, origin, dx, 0, nullptr, nullptr);
+            lo.swap(hi);
+        }
+    }
+    for (int k=0; k<nk; ++k) first_vertex[k+1] += first_vertex[k];
+
+    mesh.vertList.assign(first_vertex[nk], Vec3f(0, 0, 0));
+    std::vector<std::vector<Vec3ui> > slab_tris(num_slabs);
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int s=0; s<num_slabs; ++s) {
+        int k0 = (int)((long long)nk*s/num_slabs), k1 = (int)((long long)nk*(s+1)/num_slabs);
+        // Node layers k, k+1 and k+2, and the edge numbers of layers k and k+1.
+        std::vector<float> v0(layer), v1(layer), v2(layer);
+        std::vector<unsigned> ids0(3*layer), ids1(3*layer);
+        read_layer(k0, v0.data());
+        if (k0+1 < nk) read_layer(k0+1, v1.data());
+        number_edges(v0.data(), k0+1 < nk ? v1.data() : nullptr, ni, nj, k0, iso, origin, dx,
+                     first_vertex[k0], ids0.data(), mesh.vertList.data());
+        auto &tris = slab_tris[s];
+        for (int k=k0; k<k1 && k+1<nk; ++k) {
+            if (k+2 < nk) read_layer(k+2, v2.data());
+            // Layer k+1 belongs to the next slab if k+1 == k1, which numbers it alike.
+            number_edges(v1.data(), k+2 < nk ? v2.data() : nullptr, ni, nj, k+1, iso, origin, dx,
+                         first_vertex[k+1], ids1.data(), k+1 < k1 ? mesh.vertList.data() : nullptr);
+            const float *values[2] = {v0.data(), v1.data()};
+            const unsigned *ids[2] = {ids0.data(), ids1.data()};
+            for (int j=0; j+1<nj; ++j) {
+                for (int i=0; i+1<ni; ++i) {
+                    int pattern = 0;
+                    for (int c=0; c<8; ++c) {
+                        size_t n = (i + (c&1)) + (size_t)ni*(j + (c>>1&1));
+                        if (values[c>>2][n] < iso) pattern |= 1<<c;
+                    }
+                    for (int t=0; t<table.num_tris[pattern]; ++t) {
+                        unsigned f[3];
+                        for (int m=0; m<3; ++m) {
+                            int e = table.tri[pattern][t][m], c = table.corner[e][0];
+                            size_t n = (i + (c&1)) + (size_t)ni*(j + (c>>1&1));
+                            f[m] = ids[c>>2][3*n + e/4];
+                        }
+                        tris.push_back(Vec3ui(f[0], f[1], f[2]));
+                    }
+                }
+            }
+            v0.swap(v1);
+            v1.swap(v2);
+            ids0.swap(ids1);
+        }
+    }
+
+    mesh.faceList.clear();
+    for (auto &tris: slab_tris) mesh.faceList.insert(mesh.faceList.end(), tris.begin(), tris.end());
+    mesh.min_box = origin;
+    mesh.max_box = origin + dx*Vec3f(ni-1, nj-1, nk-1);
+}
+
+void extract_isosurface(const Array3f &phi, const Vec3f &origin, float dx, float iso,
+                        Triangulation &mesh) {
+    size_t layer = (size_t)phi.ni*phi.nj;
+    extract_isosurface(phi.ni, phi.nj, phi.nk, origin, dx, [&](int k, float *out) {
+        std::memcpy(out, phi.a.data + k*layer, layer*sizeof(float));
+    }, iso, mesh);
+}
+
+void extract_isosurface(const SDFGrid &g, const Channel &phi, float iso, Triangulation &mesh) {
+    size_t layer = (size_t)g.ni*g.nj;
+    extract_isosurface(g.ni, g.nj, g.nk, g.origin, g.dx, [&](int k, float *out) {
+        decode_values(phi.data(), k*layer, layer, phi.encoding, phi.scale, out);
+    }, iso, mesh);
+}
+
+template <typename T>
+static void put(std::vector<char> &buffer, const T &value) {
+    const char *p = (const char*)&value;
+    buffer.insert(buffer.end(), p, p+sizeof(T));
+}
+
+void write_mesh(std::string filename, const Triangulation &mesh) {
+    std::vector<char> buffer;
+    auto dot = filename.find_last_of('.');
+    if (dot != std::string::npos && lower(filename.substr(dot+1)) == "ply") {
+        std::string header = "ply\nformat binary_little_endian 1.0\n"
+            "element vertex " + std::to_string(mesh.vertList.size()) + "\n"
+            "property float x\nproperty float y\nproperty float z\n"
+            "element face " + std::to_string(mesh.faceList.size()) + "\n"
+            "property list uchar int vertex_indices\nend_header\n";
+        buffer.assign(header.begin(), header.end());
+        for (auto &v: mesh.vertList) put(buffer, v);
+        for (auto &f: mesh.faceList) {
+            put(buffer, (unsigned char)3);
+            put(buffer, f);
+        }
+    }
+    else {
+        buffer.assign(80, 0);
+        std::strncpy(&buffer[0], "SDFGen iso-surface", 80);
+        put(buffer, (unsigned)mesh.faceList.size());
+        for (auto &f: mesh.faceList) {
+            const Vec3f &a = mesh.vertList[f[0]], &b = mesh.vertList[f[1]], &c = mesh.vertList[f[2]];
+            Vec3f n = cross(b-a, c-a);
+            float length = mag(n);
+            put(buffer, length > 0 ? n/length : n);
+            put(buffer, a);
+            put(buffer, b);
+            put(buffer, c);
+            put(buffer, (unsigned short)0);
+        }
+    }
+    std::ofstream fid(filename, std::ios::out|std::ios::binary);
+    fid.write(buffer.data(), buffer.size());
+    if (!fid) {
+        std::cerr << "Failed to write " << filename << ". Terminating.\n";
+        exit(-1);
+    }
+}
+
+// Largest and mean distance from the vertices of from to the triangles of to.
+static void vertex_distances(const Triangulation &from, const Triangulation &to,
+                             float &max_distance, float &mean_distance) {
+    if (to.faceList.empty()) {
+        max_distance = mean_distance = std::numeric_limits<float>::infinity();
+        return;
+    }
+    TriangleBVH bvh(to.faceList, to.vertList);
+    float largest = 0;
+    double sum = 0;
+    #pragma omp parallel for schedule(dynamic, 1024) reduction(max:largest) reduction(+:sum)
+    for (long long v=0; v<(long long)from.vertList.size(); ++v) {
+        int closest = -1;
+        float d = bvh.distance(from.vertList[v], closest);
+        if (d > largest) largest = d;
+        sum += d;
+    }
+    max_distance = largest;
+    mean_distance = from.vertList.empty() ? 0 : (float)(sum/from.vertList.size());
+}
+
+MeshDeviation mesh_deviation(const Triangulation &surface, const Triangulation &reference) {
+    MeshDeviation d;
+    vertex_distances(surface, reference, d.max_to_reference, d.mean_to_reference);
+    vertex_distances(reference, surface, d.max_from_reference, d.mean_from_reference);
+    return d;
+}
+
+void print_surface_check(const Triangulation &surface, const Triangulation *reference, float dx) {
+    cout << "Iso-surface has " << surface.vertList.size() << " vertices and "
+         << surface.faceList.size() << " triangles.\n";
+    if (!reference) return;
+    auto d = mesh_deviation(surface, *reference);
+    cout << "Deviation from the input mesh (max, mean; in cells of " << dx << "):\n"
+         << "  surface to mesh: " << d.max_to_reference << ", " << d.mean_to_reference
+         << " (" << d.max_to_reference/dx << ", " << d.mean_to_reference/dx << ")\n"
+         << "  mesh to surface: " << d.max_from_reference << ", " << d.mean_from_reference
+         << " (" << d.max_from_reference/dx << ", " << d.mean_from_reference/dx << ")\n";
+}
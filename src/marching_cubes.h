@@ -0,0 +1,38 @@
+#pragma once
+#include <functional>
+#include <string>
+#include "array3.h"
+#include "readers.h"
+#include "binary_output.h"
+
+// Fills layer[0..ni*nj-1] with layer k of a grid (i fastest).
+typedef std::function<void(int k, float *layer)> LayerReader;
+
+// Extracts the iso-surface phi = iso of a grid with ni x nj x nk nodes at origin
+// with spacing dx by marching cubes, reading the grid one layer at a time.  Slabs
+// of cells along k are extracted in parallel.  Each crossed grid edge gives one
+// shared vertex, so the surface is indexed and, away from the grid boundary,
+// closed; faces on ambiguous cube faces always separate the inside corners, so
+// neighbouring cubes agree.  Triangles face away from phi < iso.  The result
+// replaces mesh, with bounds set to the grid.
+void extract_isosurface(int ni, int nj, int nk, const Vec3f &origin, float dx,
+                        const LayerReader &read_layer, float iso, Triangulation &mesh);
+void extract_isosurface(const Array3f &phi, const Vec3f &origin, float dx, float iso,
+                        Triangulation &mesh);
+// As above for a channel of a grid record (decoded layer by layer, so mapped files
+// are streamed).
+void extract_isosurface(const SDFGrid &g, const Channel &phi, float iso, Triangulation &mesh);
+
+// Writes a mesh as binary STL, or as binary PLY if the file name ends in .ply.
+void write_mesh(std::string filename, const Triangulation &mesh);
+
+// Vertex-sampled two-sided deviation between a surface and a reference mesh: the
+// distances from the vertices of each to the triangles of the other.
+struct MeshDeviation {
+    float max_to_reference, mean_to_reference;
+    float max_from_reference, mean_from_reference;
+};
+MeshDeviation mesh_deviation(const Triangulation &surface, const Triangulation &reference);
+// Prints the size of surface and, if reference is given, its deviation from it,
+// also in cells of size dx.
+void print_surface_check(const Triangulation &surface, const Triangulation *reference, float dx);
@@ -0,0 +1,49 @@
+#include "mesh_order.h"
+#include "hashgrid.h"
+
+std::vector<int> morton_order(const std::vector<Vec3f> &points) {
+    std::vector<int> order(points.size());
+    if (points.empty()) return order;
+    Vec3f lo = points[0], hi = lo;
+    for (auto &p: points) update_minmax(p, lo, hi);
+    double scale = ((1 << 21) - 1)/max((double)max(hi[0]-lo[0], hi[1]-lo[1], hi[2]-lo[2]), 1e-30);
+    std::vector<unsigned long long> codes(points.size());
+    #pragma omp parallel for schedule(static)
+    for (long long q=0; q<(long long)points.size(); ++q) {
+        Vec3d c = Vec3d(points[q] - lo)*scale;
+        codes[q] = morton_code(c[0], c[1], c[2]);
+        order[q] = q;
+    }
+    radix_sort(codes, order, morton_code((1 << 21) - 1, (1 << 21) - 1, (1 << 21) - 1));
+    return order;
+}
+
+void reorder_mesh(std::vector<Vec3ui> &tri, std::vector<Vec3f> &x, std::vector<int> &original_tri) {
+    std::vector<Vec3f> centroids(tri.size());
+    #pragma omp parallel for schedule(static)
+    for (long long t=0; t<(long long)tri.size(); ++t) {
+        centroids[t] = (x[tri[t][0]] + x[tri[t][1]] + x[tri[t][2]])/3.f;
+    }
+    original_tri = morton_order(centroids);
+
+    // New vertex numbers in order of first use; unused vertices go last.
+    std::vector<int> new_index(x.size(), -1);
+    std::vector<Vec3f> new_x;
+    new_x.reserve(x.size());
+    std::vector<Vec3ui> new_tri(tri.size());
+    for (size_t t=0; t<tri.size(); ++t) {
+        const Vec3ui &old = tri[original_tri[t]];
+        for (int c=0; c<3; ++c) {
+            if (new_index[old[c]] < 0) {
+                new_index[old[c]] = new_x.size();
+                new_x.push_back(x[old[c]]);
+            }
+            new_tri[t][c] = new_index[old[c]];
+        }
+    }
+    for (size_t v=0; v<x.size(); ++v) {
+        if (new_index[v] < 0) new_x.push_back(x[v]);
+    }
+    tri.swap(new_tri);
+    x.swap(new_x);
+}
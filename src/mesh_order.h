@@ -0,0 +1,28 @@
+#pragma once
+#include <vector>
+#include "vec.h"
+
+// Spreads the low 21 bits of v so that bit b moves to bit 3b.
+inline unsigned long long spread_bits(unsigned long long v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffull;
+    v = (v | v << 16) & 0x1f0000ff0000ffull;
+    v = (v | v << 8)  & 0x100f00f00f00f00full;
+    v = (v | v << 4)  & 0x10c30c30c30c30c3ull;
+    v = (v | v << 2)  & 0x1249249249249249ull;
+    return v;
+}
+
+// Morton (Z-order) code interleaving the low 21 bits of i, j and k.
+inline unsigned long long morton_code(unsigned int i, unsigned int j, unsigned int k) {
+    return spread_bits(i) | spread_bits(j) << 1 | spread_bits(k) << 2;
+}
+
+// Indices of the points sorted by their Morton code on a 2^21 grid over their
+// bounding box, so that points visited in this order are mostly close together.
+std::vector<int> morton_order(const std::vector<Vec3f> &points);
+
+// Sorts the triangles by the Morton code of their centroids and renumbers the
+// vertices in order of first use, so that triangles and vertices close in space are
+// also close in memory.  original_tri[t] is the index triangle t had before.
+void reorder_mesh(std::vector<Vec3ui> &tri, std::vector<Vec3f> &x, std::vector<int> &original_tri);
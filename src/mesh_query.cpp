@@ -0,0 +1,183 @@
+#include "mesh_query.h"
+#include "makelevelset3.h"
+#include "mesh_order.h"
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+// Triangles per leaf.
+static const int leaf_size = 4;
+// Entries in the traversal stacks.  A search holds at most one entry per level plus
+// one, and median splits keep the tree under log2(triangles) levels deep, so this
+// covers any int count of triangles.
+static const int stack_size = 64;
+// Queries are handed to threads in runs of this many consecutive (sorted) points.
+static const int run_size = 256;
+
+TriangleBVH::TriangleBVH(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x) : height(0) {
+    std::vector<Vec3f> centroids(tri.size());
+    order.resize(tri.size());
+    for (size_t t=0; t<tri.size(); ++t) {
+        centroids[t] = (x[tri[t][0]] + x[tri[t][1]] + x[tri[t][2]])/3.f;
+        order[t] = t;
+    }
+    corners.resize(3*tri.size());
+    slot.resize(tri.size());
+    if (tri.empty()) return;
+    nodes.reserve(2*tri.size()/leaf_size + 1);
+    build(0, tri.size(), centroids, 0);
+    assert(height < stack_size);
+    for (size_t s=0; s<order.size(); ++s) {
+        for (int c=0; c<3; ++c) corners[3*s+c] = x[tri[order[s]][c]];
+        slot[order[s]] = s;
+    }
+    // Bounds are computed from the corners, so they are filled in bottom up here.
+    for (int n=nodes.size()-1; n>=0; --n) {
+        Node &node = nodes[n];
+        if (node.count) {
+            node.lo = node.hi = corners[3*node.first];
+            for (int s=3*node.first; s<3*(node.first+node.count); ++s) {
+                update_minmax(corners[s], node.lo, node.hi);
+            }
+        }
+        else {
+            const Node &a = nodes[n+1], &b = nodes[node.first];
+            for (int d=0; d<3; ++d) {
+                node.lo[d] = min(a.lo[d], b.lo[d]);
+                node.hi[d] = max(a.hi[d], b.hi[d]);
+            }
+        }
+    }
+}
+
+// Splits order[begin,end) at the median centroid along its longest axis.
+int TriangleBVH::build(int begin, int end, const std::vector<Vec3f> &centroids, int depth) {
+    int index = nodes.size();
+    height = max(height, depth);
+    nodes.push_back(Node());
+    Vec3f lo = centroids[order[begin]], hi = lo;
+    for (int s=begin+1; s<end; ++s) update_minmax(centroids[order[s]], lo, hi);
+    Vec3f extent = hi - lo;
+    int axis = extent[0] >= extent[1] ? (extent[0] >= extent[2] ? 0 : 2)
+                                      : (extent[1] >= extent[2] ? 1 : 2);
+    if (end - begin <= leaf_size || extent[axis] == 0) {
+        nodes[index].first = begin;
+        nodes[index].count = end - begin;
+        return index;
+    }
+    int mid = (begin + end)/2;
+    std::nth_element(order.begin()+begin, order.begin()+mid, order.begin()+end,
+                     [&](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+    build(begin, mid, centroids, depth+1);
+    int second = build(mid, end, centroids, depth+1);
+    nodes[index].first = second;
+    nodes[index].count = 0;
+    return index;
+}
+
+// Squared distance from p to the box [lo,hi].
+static inline float box_distance2(const Vec3f &p, const Vec3f &lo, const Vec3f &hi) {
+    float d2 = 0;
+    for (int d=0; d<3; ++d) {
+        float e = max(lo[d] - p[d], 0.f, p[d] - hi[d]);
+        d2 += e*e;
+    }
+    return d2;
+}
+
+float TriangleBVH::distance(const Vec3f &p, int &closest_tri) const {
+    float best = std::numeric_limits<float>::max();
+    int best_slot = -1;
+    if (closest_tri >= 0 && closest_tri < (int)order.size()) {
+        int s = slot[closest_tri];
+        best = point_triangle_distance(p, corners[3*s], corners[3*s+1], corners[3*s+2]);
+        best_slot = s;
+    }
+    if (nodes.empty()) return best;
+    // Nodes still to visit, with the squared distance to their box.
+    std::pair<int,float> stack[stack_size];
+    int top = 0;
+    stack[top++] = std::make_pair(0, box_distance2(p, nodes[0].lo, nodes[0].hi));
+    while (top) {
+        auto entry = stack[--top];
+        if (entry.second >= best*best) continue;
+        const Node &node = nodes[entry.first];
+        if (node.count) {
+            for (int s=node.first; s<node.first+node.count; ++s) {
+                float d = point_triangle_distance(p, corners[3*s], corners[3*s+1], corners[3*s+2]);
+                if (d < best) {
+                    best = d;
+                    best_slot = s;
+                }
+            }
+            continue;
+        }
+        // Push the farther child first so the nearer one is searched first.
+        int a = entry.first+1, b = node.first;
+        float da = box_distance2(p, nodes[a].lo, nodes[a].hi);
+        float db = box_distance2(p, nodes[b].lo, nodes[b].hi);
+        if (da < db) {
+            std::swap(a, b);
+            std::swap(da, db);
+        }
+        stack[top++] = std::make_pair(a, da);
+        stack[top++] = std::make_pair(b, db);
+    }
+    // With a NaN point (or NaN corners) no distance compares below best.
+    closest_tri = best_slot >= 0 ? order[best_slot] : -1;
+    return best;
+}
+
+int TriangleBVH::crossings(const Vec3f &p) const {
+    if (nodes.empty()) return 0;
+    int count = 0;
+    int stack[stack_size];
+    int top = 0;
+    stack[top++] = 0;
+    while (top) {
+        const Node &node = nodes[stack[--top]];
+        if (node.lo[0] > p[0] || node.lo[1] > p[1] || node.hi[1] < p[1]
+                || node.lo[2] > p[2] || node.hi[2] < p[2]) continue;
+        if (node.count == 0) {
+            stack[top++] = &node - &nodes[0] + 1;
+            stack[top++] = node.first;
+            continue;
+        }
+        for (int s=node.first; s<node.first+node.count; ++s) {
+            const Vec3f *c = &corners[3*s];
+            double a, b, w;
+            if (point_in_triangle_2d(p[1], p[2], c[0][1], c[0][2], c[1][1], c[1][2],
+                                     c[2][1], c[2][2], a, b, w)) {
+                // Crossings at or behind p count, as in make_level_set3's (i-1,i] intervals.
+                if (a*c[0][0] + b*c[1][0] + w*c[2][0] <= p[0]) ++count;
+            }
+        }
+    }
+    return count;
+}
+
+void signed_distance_at_points(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                               const std::vector<Vec3f> &points, std::vector<float> &phi,
+                               std::vector<int> *closest_tri) {
+    phi.assign(points.size(), 0.f);
+    if (closest_tri) closest_tri->assign(points.size(), -1);
+    if (points.empty()) return;
+    TriangleBVH bvh(tri, x);
+
+    // Sort the points along a Morton curve.
+    std::vector<int> sorted = morton_order(points);
+
+    int num_runs = (points.size() + run_size - 1)/run_size;
+    #pragma omp parallel for schedule(dynamic)
+    for (int r=0; r<num_runs; ++r) {
+        // Consecutive points are close, so each starts from its predecessor's triangle.
+        int guess = -1;
+        size_t last = min(points.size(), (size_t)(r+1)*run_size);
+        for (size_t s=(size_t)r*run_size; s<last; ++s) {
+            int q = sorted[s];
+            float d = bvh.distance(points[q], guess);
+            phi[q] = bvh.crossings(points[q]) % 2 ? -d : d;
+            if (closest_tri) (*closest_tri)[q] = guess;
+        }
+    }
+}
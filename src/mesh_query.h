@@ -0,0 +1,43 @@
+#pragma once
+#include <vector>
+#include "vec.h"
+
+// Bounding volume hierarchy over the triangles of a mesh, answering exact
+// closest-triangle and ray crossing queries at arbitrary points.
+class TriangleBVH {
+public:
+    TriangleBVH(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x);
+
+    // Unsigned distance from p to the mesh, setting closest_tri to the index of the
+    // closest triangle (-1 if none compares closer, e.g. for a NaN point).  If closest_tri is a valid index on entry it is used as a
+    // first guess, which speeds up runs of nearby queries.
+    float distance(const Vec3f &p, int &closest_tri) const;
+
+    // Number of triangles crossed by the ray from p toward -x, with ties broken as
+    // in make_level_set3; odd means p is inside a closed mesh.
+    int crossings(const Vec3f &p) const;
+
+private:
+    // Interior nodes have count 0, their first child next in the array and the
+    // second at index first.  Leaves hold triangles first..first+count-1.
+    struct Node {
+        Vec3f lo, hi;
+        int first, count;
+    };
+    int build(int begin, int end, const std::vector<Vec3f> &centroids, int depth);
+
+    std::vector<Node> nodes;
+    // Levels below the root of the deepest leaf.
+    int height;
+    // Triangle indices in leaf order, the position of each triangle in that order,
+    // and the triangle corners stored in that order.
+    std::vector<int> order, slot;
+    std::vector<Vec3f> corners;
+};
+
+// Exact signed distance (negative inside) from the closed mesh tri/x at each
+// point, in the order given; optionally also the closest triangle of each point.
+// Points are processed in parallel in Morton order for cache coherence.
+void signed_distance_at_points(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                               const std::vector<Vec3f> &points, std::vector<float> &phi,
+                               std::vector<int> *closest_tri=nullptr);
@@ -0,0 +1,249 @@
+#ifndef OPEN_HASHTABLE_H
+#define OPEN_HASHTABLE_H
+
+// An open-addressing alternative to HashTable with the same interface, so it can
+// be dropped into HashGrid2/HashGrid3.  Entries live directly in a flat slot
+// array split into groups of 16; a parallel array of control bytes holds a 7-bit
+// tag of each occupied slot's hash, and a lookup compares the tag against a whole
+// group at once (with SSE2 when available) before touching any keys.  Like
+// HashTable it is a multimap: add() never replaces, and entries with equal keys
+// are all found by append_all_entries (in probe order rather than newest first).
+
+#include "hashtable.h"
+#include <algorithm>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+template<class Key, class Data>
+struct OpenHashEntry
+{
+   Key key;
+   Data data;
+};
+
+template<typename Key, typename Data, class HashFunction=DefaultHashFunction, class KeyEqual=equal>
+struct OpenHashTable
+{
+   enum { GROUP=16, EMPTY=0x80, DELETED=0xfe }; // control bytes of used slots are 0..0x7f
+
+   unsigned int group_bits; // there are 1<<group_bits groups of GROUP slots
+   unsigned int num_entries, num_deleted;
+   std::vector<unsigned char> control;
+   std::vector<OpenHashEntry<Key, Data> > slots;
+   const HashFunction hash_function;
+   const KeyEqual key_equal;
+
+   explicit OpenHashTable(unsigned int expected_size=64)
+      : hash_function(HashFunction()), key_equal(KeyEqual())
+   { init(expected_size); }
+
+   explicit OpenHashTable(const HashFunction &hf, unsigned int expected_size=64)
+      : hash_function(hf), key_equal(KeyEqual())
+   { init(expected_size); }
+
+   void init(unsigned int expected_size)
+   {
+      group_bits=1;
+      while(max_load(group_bits) < expected_size)
+         ++group_bits;
+      num_entries=num_deleted=0;
+      control.assign(GROUP<<group_bits, (unsigned char)EMPTY);
+      slots.resize(GROUP<<group_bits);
+   }
+
+   // at most 7/8 of the slots are used (including deleted ones) before growing
+   static unsigned int max_load(unsigned int bits)
+   { return (GROUP<<bits)/8*7; }
+
+   // the group is chosen by the high bits of the hash, which are the best mixed for
+   // the multiplicative hash(); the tag comes from a remix of the middle bits
+   unsigned int first_group(unsigned int h) const
+   { return h>>(32-group_bits); }
+
+   static unsigned char tag(unsigned int h)
+   { return (h^(h>>15))&0x7f; }
+
+   // bit s of the result is set if control byte s of group g equals c
+   unsigned int match(unsigned int g, unsigned char c) const
+   {
+#if defined(__SSE2__)
+      __m128i group=_mm_loadu_si128((const __m128i*)&control[g*GROUP]);
+      return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)c)));
+#else
+      unsigned int mask=0;
+      for(int s=0; s<GROUP; ++s)
+         if(control[g*GROUP+s]==c) mask|=1u<<s;
+      return mask;
+#endif
+   }
+
+   // bit s is set if slot s of group g is empty or deleted (the only bytes with
+   // the high bit set)
+   unsigned int match_free(unsigned int g) const
+   {
+#if defined(__SSE2__)
+      return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)&control[g*GROUP]));
+#else
+      unsigned int mask=0;
+      for(int s=0; s<GROUP; ++s)
+         if(control[g*GROUP+s]&0x80) mask|=1u<<s;
+      return mask;
+#endif
+   }
+
+   // groups are probed quadratically (g, g+1, g+3, g+6, ...), which visits every
+   // group since their number is a power of two
+   unsigned int next_group(unsigned int g, unsigned int step) const
+   { return (g+step)&((1u<<group_bits)-1); }
+
+   static int first_bit(unsigned int mask)
+   { return __builtin_ctz(mask); }
+
+   // calls f(slot) for every slot holding key k, in probe order, until f returns true;
+   // returns the slot f accepted or -1
+   template<class F>
+   int find_slot(const Key &k, F f) const
+   {
+      unsigned int h=hash_function(k), g=first_group(h);
+      unsigned char t=tag(h);
+      for(unsigned int step=1; ; ++step){
+         for(unsigned int mask=match(g, t); mask; mask&=mask-1){
+            int s=g*GROUP+first_bit(mask);
+            if(key_equal(k, slots[s].key) && f(s))
+               return s;
+         }
+         if(match(g, EMPTY) || step>(1u<<group_bits)) // an empty slot ends the probe sequence
+            return -1;
+         g=next_group(g, step);
+      }
+   }
+
+   // first free slot on k's probe sequence; the table must not be full
+   int insert_slot(unsigned int h) const
+   {
+      unsigned int g=first_group(h);
+      for(unsigned int step=1; ; ++step){
+         unsigned int mask=match_free(g);
+         if(mask) return g*GROUP+first_bit(mask);
+         g=next_group(g, step);
+      }
+   }
+
+   int insert(const Key &k, const Data &d)
+   {
+      if(num_entries+num_deleted>=max_load(group_bits))
+         rehash(num_entries+1>max_load(group_bits)/2 ? group_bits+1 : group_bits);
+      unsigned int h=hash_function(k);
+      int s=insert_slot(h);
+      if(control[s]==DELETED) --num_deleted;
+      control[s]=tag(h);
+      slots[s].key=k;
+      slots[s].data=d;
+      ++num_entries;
+      return s;
+   }
+
+   void add(const Key &k, const Data &d)
+   { insert(k, d); }
+
+   void delete_entry(const Key &k, const Data &d) // delete first entry that matches both key and data
+   {
+      int s=find_slot(k, [&](int s){ return d==slots[s].data; });
+      if(s<0) return;
+      --num_entries;
+      // a group that still has an empty slot was never full, so no probe sequence
+      // continues past it and the slot can become empty again
+      if(match(s/GROUP, EMPTY))
+         control[s]=EMPTY;
+      else{
+         control[s]=DELETED;
+         ++num_deleted;
+      }
+   }
+
+   unsigned int size() const
+   { return num_entries; }
+
+   void clear()
+   {
+      num_entries=num_deleted=0;
+      std::fill(control.begin(), control.end(), (unsigned char)EMPTY);
+   }
+
+   void reserve(unsigned int expected_size)
+   {
+      unsigned int bits=group_bits;
+      while(max_load(bits) < expected_size)
+         ++bits;
+      if(bits>group_bits)
+         rehash(bits);
+   }
+
+   // moves every entry into a table of 1<<bits groups, dropping deleted slots
+   void rehash(unsigned int bits)
+   {
+      std::vector<unsigned char> old_control;
+      std::vector<OpenHashEntry<Key, Data> > old_slots;
+      old_control.swap(control);
+      old_slots.swap(slots);
+      control.assign(GROUP<<bits, (unsigned char)EMPTY);
+      slots.resize(GROUP<<bits);
+      group_bits=bits;
+      num_deleted=0;
+      for(size_t s=0; s<old_slots.size(); ++s){
+         if(old_control[s]&0x80) continue;
+         unsigned int h=hash_function(old_slots[s].key);
+         int t=insert_slot(h);
+         control[t]=tag(h);
+         slots[t]=old_slots[s];
+      }
+   }
+
+   bool has_entry(const Key &k) const
+   { return find_slot(k, [](int){ return true; })>=0; }
+
+   bool get_entry(const Key &k, Data &data_return) const
+   {
+      int s=find_slot(k, [](int){ return true; });
+      if(s<0) return false;
+      data_return=slots[s].data;
+      return true;
+   }
+
+   void append_all_entries(const Key& k, std::vector<Data>& data_return) const
+   { find_slot(k, [&](int s){ data_return.push_back(slots[s].data); return false; }); }
+
+   Data &operator() (const Key &k, const Data &missing_data)
+   {
+      int s=find_slot(k, [](int){ return true; });
+      if(s<0) s=insert(k, missing_data);
+      return slots[s].data;
+   }
+
+   const Data &operator() (const Key &k, const Data &missing_data) const
+   {
+      int s=find_slot(k, [](int){ return true; });
+      return s<0 ? missing_data : slots[s].data;
+   }
+
+   void output_statistics() const
+   {
+      // how many groups each entry's lookup has to probe
+      std::vector<int> probecount(1);
+      for(size_t s=0; s<slots.size(); ++s){
+         if(control[s]&0x80) continue;
+         unsigned int g=first_group(hash_function(slots[s].key)), probes=1;
+         for(unsigned int step=1; g!=s/GROUP; ++step, ++probes)
+            g=next_group(g, step);
+         if(probes>=probecount.size()) probecount.resize(probes+1);
+         ++probecount[probes];
+      }
+      std::cout<<num_entries<<" entries, "<<num_deleted<<" deleted, "<<slots.size()<<" slots"<<std::endl;
+      for(unsigned int p=1; p<probecount.size(); ++p)
+         if(probecount[p]>0)
+            std::cout<<"groups probed "<<p<<": "<<probecount[p]<<"   ("<<probecount[p]/(float)num_entries*100.0<<"%)"<<std::endl;
+   }
+};
+
+#endif
@@ -0,0 +1,132 @@
+#include "pipeline.h"
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::cout;
+
+// Bytes of the binary STL header (80 byte comment and face count) and of one face
+// (normal, three corners and a 2 byte attribute).
+static const size_t header_size = 84, face_size = 50;
+
+// Reads faces first..first+count-1 of the binary STL file fd as 3*count corners;
+// returns false if the file ends or cannot be read.
+static bool read_stl_faces(int fd, size_t first, size_t count, std::vector<Vec3f> &corners) {
+    std::vector<char> buffer(count*face_size);
+    size_t done = 0;
+    while (done < buffer.size()) {
+        ssize_t r = pread(fd, &buffer[done], buffer.size()-done, header_size + first*face_size + done);
+        if (r <= 0) return false;
+        done += r;
+    }
+    corners.resize(3*count);
+    for (size_t f=0; f<count; ++f) {
+        // Skip the normal.
+        std::memcpy(&corners[3*f], &buffer[f*face_size + 12], 3*sizeof(Vec3f));
+    }
+    return true;
+}
+
+void make_level_set3_pipelined(std::string filename, const Vec3f &origin, float dx,
+                               const Vec3ui &sizes, Array3f &phi, Array3i &closest_tri,
+                               const LevelSetOptions &opts, LevelSetChannels *channels,
+                               Triangulation &mesh, LevelSetSink *sink, int num_readers,
+                               int batch_size, int queue_size) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    unsigned num_faces = 0;
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || pread(fd, &num_faces, sizeof(num_faces), 80) != sizeof(num_faces)) {
+        std::cerr << "Failed to open " << filename << ". Terminating.\n";
+        exit(-1);
+    }
+    if ((size_t)st.st_size < header_size + num_faces*face_size) {
+        std::cerr << "Truncated binary STL file " << filename << ". Terminating.\n";
+        exit(-1);
+    }
+    size_t num_batches = (num_faces + batch_size - 1)/batch_size;
+
+    // Batch b goes to slot b%queue_size once the consumer has taken batch
+    // b-queue_size, so at most queue_size batches are held at a time.  A reader that
+    // fails sets failed and stops; the others and the consumer then stop too, and
+    // the error is reported once every thread has been joined.
+    std::vector<std::vector<Vec3f> > slots(queue_size);
+    std::vector<bool> ready(queue_size, false);
+    size_t consumed = 0;
+    bool failed = false;
+    std::mutex lock;
+    std::condition_variable changed;
+    auto reader = [&](int r) {
+        std::vector<Vec3f> corners;
+        for (size_t b=r; b<num_batches; b+=num_readers) {
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                changed.wait(guard, [&]{ return failed || b < consumed + queue_size; });
+                if (failed) return;
+            }
+            size_t first = b*batch_size;
+            bool ok = read_stl_faces(fd, first, min<size_t>(batch_size, num_faces-first), corners);
+            std::unique_lock<std::mutex> guard(lock);
+            if (!ok) {
+                failed = true;
+                changed.notify_all();
+                return;
+            }
+            slots[b%queue_size].swap(corners);
+            ready[b%queue_size] = true;
+            changed.notify_all();
+        }
+    };
+    std::vector<std::thread> readers;
+    for (int r=0; r<num_readers; ++r) readers.emplace_back(reader, r);
+
+    Array3i intersection_count;
+    Array3uc initialized;
+    begin_level_set3(sizes[0], sizes[1], sizes[2], dx, phi, closest_tri, intersection_count, initialized,
+                     !opts.unsigned_distance && !opts.tri_object);
+    mesh.vertList.clear();
+    mesh.faceList.clear();
+    mesh.vertList.reserve(3*(size_t)num_faces);
+    mesh.faceList.reserve(num_faces);
+    std::vector<Vec3f> corners;
+    for (size_t b=0; b<num_batches; ++b) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            changed.wait(guard, [&]{ return failed || ready[b%queue_size]; });
+            if (failed) break;
+            corners.swap(slots[b%queue_size]);
+            ready[b%queue_size] = false;
+            consumed = b+1;
+            changed.notify_all();
+        }
+        int first = mesh.faceList.size();
+        for (size_t c=0; c<corners.size(); c+=3) {
+            auto v_ct = mesh.vertList.size();
+            mesh.vertList.insert(mesh.vertList.end(), &corners[c], &corners[c]+3);
+            mesh.faceList.emplace_back(v_ct, v_ct+1, v_ct+2);
+        }
+        rasterize_level_set3(mesh.faceList, mesh.vertList, first, origin, dx,
+                             phi, closest_tri, intersection_count, initialized, opts.exact_band);
+    }
+    for (auto &t: readers) t.join();
+    close(fd);
+    if (failed) {
+        std::cerr << "Truncated binary STL file " << filename << ". Terminating.\n";
+        exit(-1);
+    }
+
+    if (mesh.vertList.size()) {
+        mesh.max_box = mesh.min_box = mesh.vertList[0];
+    }
+    for (auto &v: mesh.vertList) {
+        update_minmax(v, mesh.min_box, mesh.max_box);
+    }
+    cout << "Read in " << mesh.vertList.size() << " vertices and "
+         << mesh.faceList.size() << " faces in " << num_batches << " batches.\n";
+    finish_level_set3(mesh.faceList, mesh.vertList, origin, dx, phi, closest_tri,
+                      intersection_count, initialized, opts, channels, sink);
+}
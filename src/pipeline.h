@@ -0,0 +1,17 @@
+#pragma once
+#include <string>
+#include "readers.h"
+#include "makelevelset3.h"
+
+// Computes the level set of the binary STL file on a grid given up front (binary
+// STL stores no bounds, so the grid cannot wait for the whole mesh), overlapping
+// reading with rasterization: num_readers threads read batches of batch_size faces
+// into a queue of at most queue_size batches, and the calling thread rasterizes
+// each batch in file order as soon as it arrives.  Triangles keep their file order,
+// and mesh is filled in as read_binary_stl would.  sink is passed on to
+// finish_level_set3.
+void make_level_set3_pipelined(std::string filename, const Vec3f &origin, float dx,
+                               const Vec3ui &sizes, Array3f &phi, Array3i &closest_tri,
+                               const LevelSetOptions &opts, LevelSetChannels *channels,
+                               Triangulation &mesh, LevelSetSink *sink=nullptr,
+                               int num_readers=2, int batch_size=1<<16, int queue_size=8);
@@ -0,0 +1,140 @@
+#include "pyramid.h"
+#include <iostream>
+#include <limits>
+
+using std::cout;
+
+// Keeps every other node of a along each axis.  The node counts are rounded up, so
+// along an axis with an even number of nodes the last node of out lies one node of a
+// past its end; those nodes are left for evaluate_outside.
+template <typename T>
+static void halve(const Array3<T, Array1<T> > &a, Array3<T, Array1<T> > &out) {
+    out.resize(a.ni/2+1, a.nj/2+1, a.nk/2+1);
+    #pragma omp parallel for schedule(static)
+    for (int k=0; k<out.nk; ++k) {
+        for (int j=0; j<out.nj; ++j) {
+            for (int i=0; i<out.ni; ++i) {
+                if (2*i < a.ni && 2*j < a.nj && 2*k < a.nk) out(i,j,k) = a(2*i, 2*j, 2*k);
+            }
+        }
+    }
+}
+
+namespace {
+struct Level {
+    Array3f phi;
+    Array3i closest_tri;
+    LevelSetChannels channels;
+};
+}
+
+// Sets the nodes of level (spacing dx) that halve left past the end of the finer
+// grids phi/closest_tri/channels.  Each takes the closest of the triangles of the
+// finer nodes around the nearest one, as a sweep would, and the sign of that nearest
+// node, which lies at most one finer spacing away.
+static void evaluate_outside(const Array3f &phi, const Array3i &closest_tri,
+                             const LevelSetChannels *channels, Level &level,
+                             const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+                             const Vec3f &origin, float dx, const LevelSetOptions &opts) {
+    LevelSetChannels &out = level.channels;
+    #pragma omp parallel for schedule(dynamic)
+    for (int k=0; k<level.phi.nk; ++k) {
+        for (int j=0; j<level.phi.nj; ++j) {
+            for (int i=0; i<level.phi.ni; ++i) {
+                if (2*i < phi.ni && 2*j < phi.nj && 2*k < phi.nk) continue;
+                Vec3i nearest(min(2*i, phi.ni-1), min(2*j, phi.nj-1), min(2*k, phi.nk-1)), from = nearest;
+                Vec3f gx = origin + dx*Vec3f(i, j, k);
+                float d = std::numeric_limits<float>::max();
+                int t = -1;
+                for (int dk=-1; dk<=1; ++dk) for (int dj=-1; dj<=1; ++dj) for (int di=-1; di<=1; ++di) {
+                    Vec3i n = nearest + Vec3i(di, dj, dk);
+                    if (n[0] < 0 || n[0] >= phi.ni || n[1] < 0 || n[1] >= phi.nj || n[2] < 0 || n[2] >= phi.nk) continue;
+                    int c = closest_tri(n[0], n[1], n[2]);
+                    if (c < 0) continue;
+                    float dc = point_triangle_distance(gx, x[tri[c][0]], x[tri[c][1]], x[tri[c][2]]);
+                    if (dc < d) {
+                        d = dc;
+                        t = c;
+                        from = n;
+                    }
+                }
+                float inner = phi(nearest[0], nearest[1], nearest[2]);
+                if (t < 0 || (opts.max_distance > 0 && d > opts.max_distance)) {
+                    // No triangle within reach: the node continues its truncated neighbour.
+                    level.phi(i,j,k) = inner;
+                    level.closest_tri(i,j,k) = -1;
+                    from = nearest;
+                }
+                else {
+                    level.phi(i,j,k) = opts.unsigned_distance ? d - opts.shell : (inner < 0 ? -d : d);
+                    level.closest_tri(i,j,k) = t;
+                }
+                if (!channels) continue;
+                if (out.objects) out.object(i,j,k) = channels->object(from[0], from[1], from[2]);
+                if (!(out.closest_points || out.gradients)) continue;
+                if (level.closest_tri(i,j,k) < 0) {
+                    for (int c=0; out.closest_points && c<3; ++c) out.closest[c](i,j,k) = channels->closest[c](from[0], from[1], from[2]);
+                    for (int c=0; out.gradients && c<3; ++c) out.gradient[c](i,j,k) = channels->gradient[c](from[0], from[1], from[2]);
+                    continue;
+                }
+                const Vec3f &p = x[tri[t][0]], &q = x[tri[t][1]], &r = x[tri[t][2]];
+                Vec3f cp = point_triangle_closest(gx, p, q, r);
+                for (int c=0; out.closest_points && c<3; ++c) out.closest[c](i,j,k) = cp[c];
+                if (out.gradients) {
+                    // As apply_signs orients them.
+                    Vec3f g = gx - cp;
+                    float m = mag(g);
+                    if (m > 1e-6f*dx) g *= (level.phi(i,j,k) < 0 && !opts.unsigned_distance ? -1.f : 1.f)/m;
+                    else g = normalized(cross(q-p, r-p));
+                    for (int c=0; c<3; ++c) out.gradient[c](i,j,k) = g[c];
+                }
+            }
+        }
+    }
+}
+
+float write_pyramid_as_binary(std::string output, int num_levels, const Array3f &phi,
+                              const Array3i &closest_tri, const std::vector<Vec3ui> &tri,
+                              const std::vector<Vec3f> &x, const Vec3f &origin, float dx,
+                              const LevelSetOptions &opts, Encoding e, float band, bool write_tri,
+                              const LevelSetChannels *channels) {
+    // Levels 1 and up; level 0 refers to the given grids.
+    std::vector<Level> levels(max(num_levels-1, 0));
+    for (size_t l=0; l<levels.size(); ++l) {
+        const Level *finer = l ? &levels[l-1] : nullptr;
+        Level &level = levels[l];
+        halve(finer ? finer->phi : phi, level.phi);
+        halve(finer ? finer->closest_tri : closest_tri, level.closest_tri);
+        const LevelSetChannels *from = channels ? (finer ? &finer->channels : channels) : nullptr;
+        if (from) {
+            LevelSetChannels &to = level.channels;
+            to.closest_points = channels->closest_points;
+            to.gradients = channels->gradients;
+            to.objects = channels->objects;
+            for (int c=0; to.closest_points && c<3; ++c) halve(from->closest[c], to.closest[c]);
+            for (int c=0; to.gradients && c<3; ++c) halve(from->gradient[c], to.gradient[c]);
+            if (to.objects) halve(from->object, to.object);
+        }
+        evaluate_outside(finer ? finer->phi : phi, finer ? finer->closest_tri : closest_tri, from,
+                         level, tri, x, origin, dx*(2 << l), opts);
+    }
+
+    std::vector<SDFGrid> grids;
+    float max_error = 0, error;
+    grids.push_back(make_level_set_grid(phi, origin, dx, e, band, write_tri ? &closest_tri : nullptr,
+                                        channels, error));
+    max_error = max(max_error, error);
+    for (size_t l=0; l<levels.size(); ++l) {
+        const Level &level = levels[l];
+        grids.push_back(make_level_set_grid(level.phi, origin, dx*(2 << l), e, band,
+                                            write_tri ? &level.closest_tri : nullptr,
+                                            channels ? &level.channels : nullptr, error, l+1));
+        max_error = max(max_error, error);
+    }
+    for (auto &g: grids) {
+        cout << "Level " << g.level << ": spacing " << g.dx << ", dimensions "
+             << g.ni << " " << g.nj << " " << g.nk << "\n";
+    }
+    write_as_binary(output, grids);
+    return max_error;
+}
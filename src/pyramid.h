@@ -0,0 +1,22 @@
+#pragma once
+#include <string>
+#include "binary_output.h"
+#include "makelevelset3.h"
+
+// Writes levels 0..num_levels-1 of an SDF pyramid as the grid records of one
+// binary file, level 0 being phi (and the channels given, as for write_as_binary).
+// Level L has spacing dx*2^L and holds the level 0 nodes whose indices are all
+// multiples of 2^L, so it starts at the same origin and every coarse node is a fine
+// node: its distance, sign and closest triangle are the ones computed there, which
+// are at least as accurate as a separate run at the coarse spacing would give.
+// Node counts are rounded up so that every level spans at least the level 0 grid;
+// coarse nodes past its end are evaluated from the closest triangles (in the order
+// of tri) of the nearest finer nodes, with the sign of the nearest one.  opts are
+// the options phi was computed with.  closest_tri is only written if write_tri.
+// Returns the largest quantization error over all levels.
+float write_pyramid_as_binary(std::string output, int num_levels, const Array3f &phi,
+                              const Array3i &closest_tri, const std::vector<Vec3ui> &tri,
+                              const std::vector<Vec3f> &x, const Vec3f &origin, float dx,
+                              const LevelSetOptions &opts, Encoding e=ENCODE_FLOAT32,
+                              float band=0, bool write_tri=false,
+                              const LevelSetChannels *channels=nullptr);
@@ -0,0 +1,172 @@
+#include "quantize.h"
+#include "util.h"
+#include "cpu_dispatch.h"
+#include <cstring>
+#include <iostream>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define QUANTIZE_HAVE_F16C_PATH
+#endif
+
+// Parses "float", "half" or "int16".
+Encoding encoding_from_string(std::string s) {
+    if (s == "float") return ENCODE_FLOAT32;
+    if (s == "half")  return ENCODE_HALF;
+    if (s == "int16") return ENCODE_INT16;
+    std::cerr << "Error: Unknown precision " << s << " (use float, half or int16).\n";
+    exit(-1);
+}
+
+// Number of bytes per value.
+int encoding_size(Encoding e) {
+    return e == ENCODE_HALF || e == ENCODE_INT16 ? 2 : 4;
+}
+
+// Converts single to half precision, rounding to nearest even.
+unsigned short float_to_half(float f) {
+    unsigned int x;
+    std::memcpy(&x, &f, sizeof(x));
+    unsigned int sign = (x >> 16) & 0x8000u;
+    unsigned int mant = x & 0x007fffffu;
+    int exp = (int)((x >> 23) & 0xff) - 127 + 15;
+    if (((x >> 23) & 0xff) == 0xff) // inf or nan
+        return sign | 0x7c00u | (mant ? 0x200u : 0);
+    if (exp >= 31) return sign | 0x7c00u; // overflow to inf
+    if (exp <= 0) { // subnormal or zero
+        if (exp < -10) return sign;
+        mant |= 0x00800000u;
+        unsigned int shift = 14 - exp;
+        unsigned int h = mant >> shift;
+        unsigned int rem = mant & ((1u << shift) - 1), half = 1u << (shift-1);
+        if (rem > half || (rem == half && (h & 1))) ++h;
+        return sign | h;
+    }
+    unsigned int h = ((unsigned int)exp << 10) | (mant >> 13);
+    unsigned int rem = mant & 0x1fffu;
+    if (rem > 0x1000u || (rem == 0x1000u && (h & 1))) ++h; // may carry into inf
+    return sign | h;
+}
+
+// Converts half to single precision (exact).
+float half_to_float(unsigned short h) {
+    unsigned int sign = (h & 0x8000u) << 16;
+    unsigned int exp = (h >> 10) & 0x1f, mant = h & 0x3ffu, x;
+    if (exp == 0x1f) x = sign | 0x7f800000u | (mant << 13);
+    else if (exp) x = sign | ((exp - 15 + 127) << 23) | (mant << 13);
+    else if (mant) { // subnormal: normalize
+        exp = 127 - 15 + 1;
+        while (!(mant & 0x400u)) { mant <<= 1; --exp; }
+        x = sign | (exp << 23) | ((mant & 0x3ffu) << 13);
+    }
+    else x = sign;
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+// Largest finite half; larger magnitudes are clamped to it before encoding.
+static const float half_max = 65504.f;
+
+#ifdef QUANTIZE_HAVE_F16C_PATH
+// F16C conversions of the largest multiple of 8 values, returning how many were done.
+__attribute__((target("avx,f16c")))
+static size_t halves_to_floats_f16c(const unsigned short *h, size_t n, float *out) {
+    size_t i = 0;
+    for (; i+8 <= n; i += 8) {
+        _mm256_storeu_ps(out+i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(h+i))));
+    }
+    return i;
+}
+
+__attribute__((target("avx,f16c")))
+static size_t floats_to_halves_f16c(const float *in, size_t n, unsigned short *q) {
+    size_t i = 0;
+    __m256 hi = _mm256_set1_ps(half_max), lo = _mm256_set1_ps(-half_max);
+    for (; i+8 <= n; i += 8) {
+        __m256 v = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(in+i), lo), hi);
+        __m128i h = _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i*)(q+i), h);
+    }
+    return i;
+}
+#endif
+
+// The int16 loops are simple enough for the compiler to vectorize for each target.
+MULTIVERSION
+static void int16_to_floats(const short *s, size_t n, float scale, float *out) {
+    for (size_t i=0; i<n; ++i) out[i] = scale*s[i];
+}
+
+MULTIVERSION
+static void floats_to_int16(const float *in, size_t n, float scale, short *s) {
+    float inv_scale = 1/scale;
+    for (size_t i=0; i<n; ++i) {
+        float v = clamp(in[i]*inv_scale, -32767.f, 32767.f);
+        s[i] = (short)std::lrint(v);
+    }
+}
+
+// Decodes a run of values, vectorized for half and int16.
+void decode_values(const void *data, size_t first, size_t n, Encoding e, float scale, float *out) {
+    if (e == ENCODE_HALF) {
+        const unsigned short *h = (const unsigned short*)data + first;
+        size_t i = 0;
+#ifdef QUANTIZE_HAVE_F16C_PATH
+        if (cpu_has_f16c()) i = halves_to_floats_f16c(h, n, out);
+#endif
+        for (; i<n; ++i) out[i] = half_to_float(h[i]);
+    }
+    else if (e == ENCODE_INT16) {
+        int16_to_floats((const short*)data + first, n, scale, out);
+    }
+    else if (e == ENCODE_FLOAT32) {
+        std::memcpy(out, (const float*)data + first, n*sizeof(float));
+    }
+    else {
+        for (size_t i=0; i<n; ++i) out[i] = decode_value(data, first+i, e, scale);
+    }
+}
+
+// The int16 scale that maps +-band (or the largest |value| if band<=0) to +-32767.
+float quantize_scale(const float *in, size_t n, Encoding e, float band) {
+    if (e != ENCODE_INT16) return 1;
+    if (band <= 0) {
+        band = 0;
+        for (size_t i=0; i<n; ++i) band = max(band, std::fabs(in[i]));
+    }
+    return band > 0 ? band/32767 : 1;
+}
+
+// Encodes n values into 16-bit storage and returns the largest error within the band.
+float quantize_values(const float *in, size_t n, Encoding e, float band, float scale,
+                      unsigned short *q) {
+    if (e == ENCODE_HALF) {
+        size_t i = 0;
+#ifdef QUANTIZE_HAVE_F16C_PATH
+        if (cpu_has_f16c()) i = floats_to_halves_f16c(in, n, q);
+#endif
+        for (; i<n; ++i) q[i] = float_to_half(clamp(in[i], -half_max, half_max));
+    }
+    else if (e == ENCODE_INT16) {
+        floats_to_int16(in, n, scale, (short*)q);
+    }
+    else {
+        std::cerr << "Error: quantize() needs a 16-bit encoding.\n";
+        exit(-1);
+    }
+
+    float max_error = 0;
+    for (size_t i=0; i<n; ++i) {
+        if (band > 0 && std::fabs(in[i]) > band) continue;
+        float v = e == ENCODE_HALF ? clamp(in[i], -half_max, half_max) : in[i];
+        max_error = max(max_error, std::fabs(decode_value(q, i, e, scale) - v));
+    }
+    return max_error;
+}
+
+// Encodes phi into 16-bit storage and returns the largest error within the band.
+float quantize(const Array3f &phi, Encoding e, float band, Array3us &out, float &scale) {
+    out.resize(phi.ni, phi.nj, phi.nk);
+    scale = quantize_scale(phi.a.data, phi.a.size(), e, band);
+    return quantize_values(phi.a.data, phi.a.size(), e, band, scale, out.a.data);
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <string>
+#include "array3.h"
+
+// Storage formats for grid values.
+enum Encoding {
+    ENCODE_FLOAT32 = 0, // IEEE single precision.
+    ENCODE_HALF    = 1, // IEEE half precision.
+    ENCODE_INT16   = 2, // Signed 16-bit integer times a scale.
+    ENCODE_INT32   = 3  // Signed 32-bit integer (indices).
+};
+
+// Parses "float", "half" or "int16".
+Encoding encoding_from_string(std::string s);
+// Number of bytes per value.
+int encoding_size(Encoding e);
+
+// Converts between single and half precision (round to nearest even).
+unsigned short float_to_half(float f);
+float half_to_float(unsigned short h);
+
+// Decodes value i from raw storage in the given encoding.
+inline float decode_value(const void *data, size_t i, Encoding e, float scale) {
+    switch (e) {
+        case ENCODE_HALF:  return half_to_float(((const unsigned short*)data)[i]);
+        case ENCODE_INT16: return scale*((const short*)data)[i];
+        case ENCODE_INT32: return (float)((const int*)data)[i];
+        default:           return ((const float*)data)[i];
+    }
+}
+
+// Decodes values first..first+n-1 from raw storage into out.
+void decode_values(const void *data, size_t first, size_t n, Encoding e, float scale, float *out);
+
+// Encodes phi into 16-bit storage (ENCODE_HALF or ENCODE_INT16).  For int16 the
+// scale is chosen so that +-band maps to +-32767, and values beyond the band
+// saturate; band<=0 uses the largest |phi|.  Half values saturate at +-65504
+// instead of becoming infinite.  Returns the largest decoding error over cells
+// with |phi| <= band, measured from the saturated values.
+float quantize(const Array3f &phi, Encoding e, float band, Array3us &out, float &scale);
+// The two steps of quantize() for values in[0..n-1], for encoding a grid in pieces:
+// the scale for the whole grid (1 unless int16), then the encoding of any part of it.
+float quantize_scale(const float *in, size_t n, Encoding e, float band);
+float quantize_values(const float *in, size_t n, Encoding e, float band, float scale,
+                      unsigned short *out);
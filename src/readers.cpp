@@ -146,3 +146,73 @@ Triangulation read_obj_file(std::string filename) {
     return mesh;
 }
 
+
+// Reads a .stl (binary) or .obj mesh, choosing the reader from the file extension.
+Triangulation read_mesh(std::string filename) {
+    auto dot = filename.find_last_of('.');
+    auto extension = dot == std::string::npos ? std::string() : lower(filename.substr(dot+1));
+    if (extension == "stl") {
+        //return read_ascii_stl(filename);
+        return read_binary_stl(filename);
+    }
+    else if (extension == "obj") {
+        return read_obj_file(filename);
+    }
+    std::cerr << "Error: Input file must have .stl or .obj extension.\n";
+    exit(-1);
+}
+
+// Appends the triangles of part to mesh and grows its bounds.
+void append_mesh(Triangulation &mesh, const Triangulation &part) {
+    if (part.vertList.empty()) return;
+    if (mesh.vertList.empty()) {
+        mesh.min_box = part.min_box;
+        mesh.max_box = part.max_box;
+    }
+    update_minmax(part.min_box, mesh.min_box, mesh.max_box);
+    update_minmax(part.max_box, mesh.min_box, mesh.max_box);
+    unsigned v_ct = mesh.vertList.size();
+    mesh.vertList.insert(mesh.vertList.end(), part.vertList.begin(), part.vertList.end());
+    for (auto &f: part.faceList) {
+        mesh.faceList.emplace_back(f[0]+v_ct, f[1]+v_ct, f[2]+v_ct);
+    }
+}
+
+// Reads a list of file names, one per line ('#' comments).
+std::vector<std::string> read_file_list(std::string filename) {
+    std::vector<std::string> files;
+    std::fstream infile(filename);
+    if (!infile) {
+        std::cerr << "Failed to open " << filename << ". Terminating.\n";
+        exit(-1);
+    }
+    while (infile) {
+        auto line = split(read_line(infile));
+        if (line.empty() || line[0][0] == '#') continue;
+        files.push_back(line[0]);
+    }
+    return files;
+}
+
+// Reads query points from a text file with one "x y z" per line ('#' comments).
+std::vector<Vec3f> read_points(std::string filename) {
+    std::vector<Vec3f> points;
+    std::fstream infile(filename);
+    if (!infile) {
+        std::cerr << "Failed to open " << filename << ". Terminating.\n";
+        exit(-1);
+    }
+    while (infile) {
+        auto line = split(read_line(infile));
+        if (line.empty() || line[0][0] == '#') continue;
+        if (line.size() < 3) {
+            std::cerr << "Error: Expected x y z for point " << points.size()+1
+                      << " of " << filename << ".\n";
+            exit(-1);
+        }
+        points.emplace_back(from_string<float>(line[0]), from_string<float>(line[1]),
+                            from_string<float>(line[2]));
+    }
+    cout << "Read " << points.size() << " points from " << filename << ".\n";
+    return points;
+}
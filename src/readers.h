@@ -19,3 +19,14 @@ Triangulation read_binary_stl(std::string filename);
 // Reads input mesh data from a Wavefront OBJ (text) file.
 Triangulation read_obj_file(std::string filename);
 
+// Reads a .stl (binary) or .obj mesh, choosing the reader from the file extension.
+Triangulation read_mesh(std::string filename);
+
+// Appends the triangles of part to mesh (which may be empty) and grows its bounds.
+void append_mesh(Triangulation &mesh, const Triangulation &part);
+
+// Reads a list of file names, one per line ('#' comments).
+std::vector<std::string> read_file_list(std::string filename);
+
+// Reads query points from a text file with one "x y z" per line ('#' comments).
+std::vector<Vec3f> read_points(std::string filename);
@@ -0,0 +1,275 @@
+#include "sampler.h"
+#include "cpu_dispatch.h"
+#include <chrono>
+#include <climits>
+#include <functional>
+#include <iostream>
+#include <vector>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SAMPLER_HAVE_AVX2_PATH
+#endif
+
+using std::cout;
+
+// Points are processed in batches of this many, in parallel across batches.
+static const size_t batch_size = 4096;
+
+// Scalar trilinear interpolation with the gradient of the interpolant.
+static void trilinear(const GridView &g, size_t first, size_t last,
+                      const float *x, const float *y, const float *z,
+                      float *value, float *gx, float *gy, float *gz) {
+    size_t dj = g.ni, dk = (size_t)g.ni*g.nj;
+    for (size_t q=first; q<last; ++q) {
+        int i, j, k;
+        float fx, fy, fz;
+        get_barycentric((x[q]-g.origin[0])/g.dx, i, fx, 0, g.ni);
+        get_barycentric((y[q]-g.origin[1])/g.dx, j, fy, 0, g.nj);
+        get_barycentric((z[q]-g.origin[2])/g.dx, k, fz, 0, g.nk);
+        const float *v = g.data + i + dj*j + dk*k;
+        float v000 = v[0],     v100 = v[1],       v010 = v[dj],    v110 = v[dj+1];
+        float v001 = v[dk],    v101 = v[dk+1],    v011 = v[dk+dj], v111 = v[dk+dj+1];
+        value[q] = trilerp(v000, v100, v010, v110, v001, v101, v011, v111, fx, fy, fz);
+        if (gx) {
+            gx[q] = bilerp(v100-v000, v110-v010, v101-v001, v111-v011, fy, fz)/g.dx;
+            gy[q] = bilerp(v010-v000, v110-v100, v011-v001, v111-v101, fx, fz)/g.dx;
+            gz[q] = bilerp(v001-v000, v101-v100, v011-v010, v111-v110, fx, fy)/g.dx;
+        }
+    }
+}
+
+#ifdef SAMPLER_HAVE_AVX2_PATH
+// Grid coordinate along one axis, clamped as get_barycentric does: returns the cell
+// index and sets f to the fraction within the cell.  Divides rather than multiplying
+// by 1/dx so that points pick the same cell as the scalar path.
+__attribute__((target("avx2,fma")))
+static inline __m256i cell_avx2(__m256 p, float origin, float dx, int n, __m256 &f) {
+    __m256 c = _mm256_div_ps(_mm256_sub_ps(p, _mm256_set1_ps(origin)), _mm256_set1_ps(dx));
+    c = _mm256_min_ps(_mm256_max_ps(c, _mm256_setzero_ps()), _mm256_set1_ps((float)(n-1)));
+    __m256i i = _mm256_min_epi32(_mm256_cvttps_epi32(_mm256_floor_ps(c)), _mm256_set1_epi32(n-2));
+    f = _mm256_sub_ps(c, _mm256_cvtepi32_ps(i));
+    return i;
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 lerp_avx2(__m256 a, __m256 b, __m256 f) {
+    return _mm256_fmadd_ps(f, _mm256_sub_ps(b, a), a);
+}
+
+// Eight points at a time with gathers for the corner values; the tail is scalar.
+__attribute__((target("avx2,fma")))
+static void trilinear_avx2(const GridView &g, size_t first, size_t last,
+                           const float *x, const float *y, const float *z,
+                           float *value, float *gx, float *gy, float *gz) {
+    float over_dx = 1/g.dx;
+    int dj = g.ni, dk = g.ni*g.nj;
+    __m256i vdj = _mm256_set1_epi32(dj), vdk = _mm256_set1_epi32(dk);
+    __m256 vover_dx = _mm256_set1_ps(over_dx);
+    size_t q = first;
+    for (; q+8 <= last; q += 8) {
+        __m256 fx, fy, fz;
+        __m256i i = cell_avx2(_mm256_loadu_ps(x+q), g.origin[0], g.dx, g.ni, fx);
+        __m256i j = cell_avx2(_mm256_loadu_ps(y+q), g.origin[1], g.dx, g.nj, fy);
+        __m256i k = cell_avx2(_mm256_loadu_ps(z+q), g.origin[2], g.dx, g.nk, fz);
+        __m256i n = _mm256_add_epi32(i, _mm256_add_epi32(_mm256_mullo_epi32(j, vdj),
+                                                         _mm256_mullo_epi32(k, vdk)));
+        __m256i one = _mm256_set1_epi32(1);
+        __m256i n010 = _mm256_add_epi32(n, vdj), n001 = _mm256_add_epi32(n, vdk);
+        __m256i n011 = _mm256_add_epi32(n010, vdk);
+        __m256 v000 = _mm256_i32gather_ps(g.data, n, 4);
+        __m256 v100 = _mm256_i32gather_ps(g.data, _mm256_add_epi32(n, one), 4);
+        __m256 v010 = _mm256_i32gather_ps(g.data, n010, 4);
+        __m256 v110 = _mm256_i32gather_ps(g.data, _mm256_add_epi32(n010, one), 4);
+        __m256 v001 = _mm256_i32gather_ps(g.data, n001, 4);
+        __m256 v101 = _mm256_i32gather_ps(g.data, _mm256_add_epi32(n001, one), 4);
+        __m256 v011 = _mm256_i32gather_ps(g.data, n011, 4);
+        __m256 v111 = _mm256_i32gather_ps(g.data, _mm256_add_epi32(n011, one), 4);
+        __m256 x00 = lerp_avx2(v000, v100, fx), x10 = lerp_avx2(v010, v110, fx);
+        __m256 x01 = lerp_avx2(v001, v101, fx), x11 = lerp_avx2(v011, v111, fx);
+        __m256 y0 = lerp_avx2(x00, x10, fy), y1 = lerp_avx2(x01, x11, fy);
+        _mm256_storeu_ps(value+q, lerp_avx2(y0, y1, fz));
+        if (gx) {
+            __m256 dz = _mm256_sub_ps(y1, y0);
+            __m256 dy = lerp_avx2(_mm256_sub_ps(x10, x00), _mm256_sub_ps(x11, x01), fz);
+            __m256 dx0 = lerp_avx2(_mm256_sub_ps(v100, v000), _mm256_sub_ps(v110, v010), fy);
+            __m256 dx1 = lerp_avx2(_mm256_sub_ps(v101, v001), _mm256_sub_ps(v111, v011), fy);
+            _mm256_storeu_ps(gx+q, _mm256_mul_ps(lerp_avx2(dx0, dx1, fz), vover_dx));
+            _mm256_storeu_ps(gy+q, _mm256_mul_ps(dy, vover_dx));
+            _mm256_storeu_ps(gz+q, _mm256_mul_ps(dz, vover_dx));
+        }
+    }
+    trilinear(g, q, last, x, y, z, value, gx, gy, gz);
+}
+
+#endif
+
+// Whether sample_grid gathers on this CPU for this grid: the gathers take 32-bit node
+// indices, so larger grids use the scalar path.
+static bool use_gathers(const GridView &g) {
+#ifdef SAMPLER_HAVE_AVX2_PATH
+    return cpu_has_avx2() && cpu_has_fma() && (size_t)g.ni*g.nj*g.nk <= INT_MAX;
+#else
+    return false;
+#endif
+}
+
+// Derivatives of cubic_interp_weights with respect to f.
+template<class T>
+inline void cubic_interp_derivative_weights(T f, T& wneg1, T& w0, T& w1, T& w2) {
+    T f2(f*f);
+    wneg1 = -T(1./3)+f-T(1./2)*f2;
+    w0 = -T(1./2)-2*f+T(3./2)*f2;
+    w1 = 1+f-T(3./2)*f2;
+    w2 = -T(1./6)+T(1./2)*f2;
+}
+
+// Tricubic interpolation over the 4x4x4 nodes around each point, repeating the
+// boundary nodes where the stencil leaves the grid.
+static void tricubic(const GridView &g, size_t first, size_t last,
+                     const float *x, const float *y, const float *z,
+                     float *value, float *gx, float *gy, float *gz) {
+    for (size_t q=first; q<last; ++q) {
+        int c[3];
+        float f[3], w[3][4], dw[3][4];
+        get_barycentric((x[q]-g.origin[0])/g.dx, c[0], f[0], 0, g.ni);
+        get_barycentric((y[q]-g.origin[1])/g.dx, c[1], f[1], 0, g.nj);
+        get_barycentric((z[q]-g.origin[2])/g.dx, c[2], f[2], 0, g.nk);
+        int n[3] = {g.ni, g.nj, g.nk}, idx[3][4];
+        for (int a=0; a<3; ++a) {
+            cubic_interp_weights(f[a], w[a][0], w[a][1], w[a][2], w[a][3]);
+            cubic_interp_derivative_weights(f[a], dw[a][0], dw[a][1], dw[a][2], dw[a][3]);
+            for (int s=0; s<4; ++s) idx[a][s] = clamp(c[a]-1+s, 0, n[a]-1);
+        }
+        float v = 0, d[3] = {0, 0, 0};
+        for (int sk=0; sk<4; ++sk) for (int sj=0; sj<4; ++sj) for (int si=0; si<4; ++si) {
+            float p = g.data[idx[0][si] + (size_t)g.ni*(idx[1][sj] + (size_t)g.nj*idx[2][sk])];
+            v += w[0][si]*w[1][sj]*w[2][sk]*p;
+            d[0] += dw[0][si]*w[1][sj]*w[2][sk]*p;
+            d[1] += w[0][si]*dw[1][sj]*w[2][sk]*p;
+            d[2] += w[0][si]*w[1][sj]*dw[2][sk]*p;
+        }
+        value[q] = v;
+        if (gx) {
+            gx[q] = d[0]/g.dx;
+            gy[q] = d[1]/g.dx;
+            gz[q] = d[2]/g.dx;
+        }
+    }
+}
+
+// Samples the grid at n points given as separate coordinate arrays.
+void sample_grid(const GridView &grid, size_t n, const float *x, const float *y, const float *z,
+                 float *value, float *gx, float *gy, float *gz, SampleMode mode) {
+    if (!gx || !gy || !gz) gx = gy = gz = nullptr;
+    long num_batches = (long)((n + batch_size - 1)/batch_size);
+#ifdef SAMPLER_HAVE_AVX2_PATH
+    bool gather = use_gathers(grid);
+#endif
+    #pragma omp parallel for schedule(dynamic)
+    for (long b=0; b<num_batches; ++b) {
+        size_t first = b*batch_size, last = min(first+batch_size, n);
+        if (mode == SAMPLE_TRICUBIC) {
+            tricubic(grid, first, last, x, y, z, value, gx, gy, gz);
+            continue;
+        }
+#ifdef SAMPLER_HAVE_AVX2_PATH
+        if (gather) {
+            trilinear_avx2(grid, first, last, x, y, z, value, gx, gy, gz);
+            continue;
+        }
+#endif
+        trilinear(grid, first, last, x, y, z, value, gx, gy, gz);
+    }
+}
+
+void sample_grid(const Array3f &phi, const Vec3f &origin, float dx,
+                 size_t n, const float *x, const float *y, const float *z,
+                 float *value, float *gx, float *gy, float *gz, SampleMode mode) {
+    GridView grid = {phi.a.data, phi.ni, phi.nj, phi.nk, origin, dx};
+    sample_grid(grid, n, x, y, z, value, gx, gy, gz, mode);
+}
+
+// Checks the batched sampler against scalar trilerp and reports samples per second.
+void run_sample_benchmark(const GridView &grid, size_t num_points) {
+    // Include points a little outside the grid to exercise the clamping.
+    Vec3f lo = grid.origin - grid.dx*Vec3f(1,1,1);
+    Vec3f extent = grid.dx*Vec3f(grid.ni+1, grid.nj+1, grid.nk+1);
+    std::vector<float> x(num_points), y(num_points), z(num_points);
+    for (size_t q=0; q<num_points; ++q) {
+        x[q] = lo[0] + randhashf(3*q, 0, extent[0]);
+        y[q] = lo[1] + randhashf(3*q+1, 0, extent[1]);
+        z[q] = lo[2] + randhashf(3*q+2, 0, extent[2]);
+    }
+    std::vector<float> ref(num_points), value(num_points), gx(num_points), gy(num_points), gz(num_points);
+    std::vector<float> ref_gx(num_points), ref_gy(num_points), ref_gz(num_points);
+
+    auto time = [&](const char *name, std::function<void()> run) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        cout << name << ": " << num_points/seconds << " samples/s\n";
+    };
+    time("scalar trilerp", [&]() {
+        trilinear(grid, 0, num_points, &x[0], &y[0], &z[0], &ref[0], nullptr, nullptr, nullptr);
+    });
+    time("batched trilinear", [&]() {
+        sample_grid(grid, num_points, &x[0], &y[0], &z[0], &value[0]);
+    });
+    float max_error = 0;
+    for (size_t q=0; q<num_points; ++q) max_error = max(max_error, std::fabs(value[q]-ref[q]));
+    cout << "Maximum difference from scalar trilerp: " << max_error << "\n";
+    time("batched trilinear with gradient", [&]() {
+        sample_grid(grid, num_points, &x[0], &y[0], &z[0], &value[0], &gx[0], &gy[0], &gz[0]);
+    });
+    trilinear(grid, 0, num_points, &x[0], &y[0], &z[0], &ref[0], &ref_gx[0], &ref_gy[0], &ref_gz[0]);
+    max_error = 0;
+    for (size_t q=0; q<num_points; ++q) {
+        max_error = max(max_error, std::fabs(gx[q]-ref_gx[q]), std::fabs(gy[q]-ref_gy[q]),
+                        std::fabs(gz[q]-ref_gz[q]));
+    }
+    cout << "Maximum gradient difference from scalar: " << max_error << "\n";
+    time("batched tricubic with gradient", [&]() {
+        sample_grid(grid, num_points, &x[0], &y[0], &z[0], &value[0], &gx[0], &gy[0], &gz[0],
+                    SAMPLE_TRICUBIC);
+    });
+    cout << "AVX2 gather path " << (use_gathers(grid) ? "enabled" : "not used for this grid on this CPU")
+         << ".\n";
+}
+
+// Compares sample_grid with the scalar path on a synthetic grid.
+bool run_sample_check(size_t num_points) {
+    int ni = 37, nj = 29, nk = 23;
+    std::vector<float> data((size_t)ni*nj*nk);
+    for (size_t n=0; n<data.size(); ++n) data[n] = randhashf(n, -10, 10);
+    GridView grid = {&data[0], ni, nj, nk, Vec3f(-1.5f, 0.25f, 2), 0.1f};
+    if (!use_gathers(grid)) {
+        cout << "AVX2 gather path not available on this CPU; nothing to check.\n";
+        return true;
+    }
+    // Points a little outside the grid exercise the clamping as well.
+    Vec3f lo = grid.origin - grid.dx*Vec3f(1,1,1);
+    Vec3f extent = grid.dx*Vec3f(ni+1, nj+1, nk+1);
+    std::vector<float> x(num_points), y(num_points), z(num_points);
+    for (size_t q=0; q<num_points; ++q) {
+        x[q] = lo[0] + randhashf(3*q, 0, extent[0]);
+        y[q] = lo[1] + randhashf(3*q+1, 0, extent[1]);
+        z[q] = lo[2] + randhashf(3*q+2, 0, extent[2]);
+    }
+    std::vector<float> value(num_points), gx(num_points), gy(num_points), gz(num_points);
+    std::vector<float> ref(num_points), ref_gx(num_points), ref_gy(num_points), ref_gz(num_points);
+    sample_grid(grid, num_points, &x[0], &y[0], &z[0], &value[0], &gx[0], &gy[0], &gz[0]);
+    trilinear(grid, 0, num_points, &x[0], &y[0], &z[0], &ref[0], &ref_gx[0], &ref_gy[0], &ref_gz[0]);
+    // The gather path contracts into FMA, so it may differ from the scalar path by
+    // rounding: a few ulps of values up to 10, and of gradients up to 200/dx.
+    float value_error = 0, gradient_error = 0;
+    for (size_t q=0; q<num_points; ++q) {
+        value_error = max(value_error, std::fabs(value[q]-ref[q]));
+        gradient_error = max(gradient_error, std::fabs(gx[q]-ref_gx[q]), std::fabs(gy[q]-ref_gy[q]),
+                             std::fabs(gz[q]-ref_gz[q]));
+    }
+    bool passed = value_error <= 1e-5f && gradient_error <= 2e-4f/grid.dx;
+    cout << "Gather path against scalar on " << num_points << " points: max value difference "
+         << value_error << ", max gradient difference " << gradient_error
+         << (passed ? "" : ", FAILED") << ".\n";
+    return passed;
+}
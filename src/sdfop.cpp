@@ -0,0 +1,137 @@
+#include "sdfop.h"
+#include "binary_output.h"
+#include "server.h"
+#include "string_tools.h"
+#include <cstring>
+#include <iostream>
+
+using std::cout;
+
+SDFOperation sdf_operation_from_string(std::string s) {
+    s = lower(s);
+    if (s == "union") return SDF_UNION;
+    if (s == "intersection") return SDF_INTERSECTION;
+    if (s == "difference") return SDF_DIFFERENCE;
+    if (s == "offset") return SDF_OFFSET;
+    std::cerr << "Error: unknown operation " << s << " (use union, intersection, difference or offset).\n";
+    exit(-1);
+}
+
+static bool same_lattice(const SDFGrid &a, const SDFGrid &b) {
+    return a.ni == b.ni && a.nj == b.nj && a.nk == b.nk
+        && std::fabs(a.dx - b.dx) <= 1e-5f*a.dx
+        && mag(a.origin - b.origin) <= 1e-3f*a.dx;
+}
+
+// Samples phi of g at x.  Outside the grid the clamped boundary value is extended
+// by the distance to the grid's box: a distance field grows by at most that much,
+// and exactly that much away from an object lying inside the box.
+static float sample_extended(const SDFGrid &g, const Channel &phi, const Vec3f &x) {
+    Vec3f top = g.origin + g.dx*Vec3f(g.ni-1, g.nj-1, g.nk-1), outside;
+    for (int d=0; d<3; ++d) outside[d] = max(g.origin[d]-x[d], x[d]-top[d], 0.f);
+    return sample_trilinear(g, phi, x, nullptr) + mag(outside);
+}
+
+// The combining loops are kept trivial so the compiler vectorizes them.
+static void combine(SDFOperation op, float *a, const float *b, size_t n) {
+    switch (op) {
+        case SDF_UNION:
+            for (size_t i=0; i<n; ++i) a[i] = b[i] < a[i] ? b[i] : a[i];
+            break;
+        case SDF_INTERSECTION:
+            for (size_t i=0; i<n; ++i) a[i] = b[i] > a[i] ? b[i] : a[i];
+            break;
+        case SDF_DIFFERENCE:
+            for (size_t i=0; i<n; ++i) a[i] = -b[i] > a[i] ? -b[i] : a[i];
+            break;
+        default:
+            break;
+    }
+}
+
+void run_sdf_operation(SDFOperation op, std::string output,
+                       const std::vector<std::string> &inputs, float distance) {
+    size_t num_inputs = op == SDF_OFFSET ? 1 : inputs.size();
+    if (inputs.empty() || (op != SDF_OFFSET && num_inputs < 2)) {
+        std::cerr << "Error: this operation needs at least two input grids.\n";
+        exit(-1);
+    }
+    std::vector<SDFGrid> grids;
+    for (size_t f=0; f<num_inputs; ++f) {
+        auto records = map_binary(inputs[f]);
+        if (records.empty() || !records[0].find("phi")) {
+            std::cerr << "Error: " << inputs[f] << " holds no phi grid.\n";
+            exit(-1);
+        }
+        grids.push_back(records[0]);
+    }
+    std::vector<const Channel*> phi;
+    for (auto &g: grids) phi.push_back(g.find("phi"));
+
+    const SDFGrid &a = grids[0];
+    SDFGrid out;
+    out.level = a.level;
+    out.ni = a.ni; out.nj = a.nj; out.nk = a.nk;
+    out.origin = a.origin;
+    out.dx = a.dx;
+    out.channels.resize(1);
+    out.channels[0].name = "phi";
+    out.channels[0].encoding = phi[0]->encoding;
+    // int16 output covers the widest int16 input band, grown by the offset, so
+    // that values inside any input's band are kept.
+    float range = 0;
+    if (phi[0]->encoding == ENCODE_INT16) {
+        for (auto c: phi) {
+            if (c->encoding == ENCODE_INT16) range = max(range, 32767*c->scale);
+        }
+        if (op == SDF_OFFSET) range += std::fabs(distance);
+    }
+    out.channels[0].scale = quantize_scale(nullptr, 0, phi[0]->encoding, range);
+    for (size_t f=1; f<grids.size(); ++f) {
+        if (!same_lattice(a, grids[f])) {
+            cout << "Resampling " << inputs[f] << " onto the lattice of " << inputs[0] << ".\n";
+        }
+    }
+
+    // About a million values per slab.
+    size_t layer = (size_t)a.ni*a.nj;
+    int slab_layers = max<int>(1, (1<<20)/layer);
+    std::vector<float> acc(slab_layers*layer), values(slab_layers*layer);
+    size_t saturated = 0;
+    write_generated_as_binary(output, out, slab_layers, [&](int, int k0, int k1, char *data) {
+        size_t n = (k1-k0)*layer, first = k0*layer;
+        decode_values(phi[0]->data(), first, n, phi[0]->encoding, phi[0]->scale, acc.data());
+        for (size_t f=1; f<grids.size(); ++f) {
+            const SDFGrid &g = grids[f];
+            if (same_lattice(a, g)) {
+                decode_values(phi[f]->data(), first, n, phi[f]->encoding, phi[f]->scale, values.data());
+            }
+            else {
+                #pragma omp parallel for schedule(static)
+                for (long long m=0; m<(long long)n; ++m) {
+                    int i = m%a.ni, j = m/a.ni%a.nj, k = k0 + m/layer;
+                    values[m] = sample_extended(g, *phi[f], a.origin + a.dx*Vec3f(i, j, k));
+                }
+            }
+            combine(op, acc.data(), values.data(), n);
+        }
+        if (op == SDF_OFFSET) {
+            for (size_t i=0; i<n; ++i) acc[i] -= distance;
+        }
+        const Channel &c = out.channels[0];
+        if (c.encoding == ENCODE_FLOAT32) {
+            std::memcpy(data, acc.data(), n*sizeof(float));
+        }
+        else {
+            if (c.encoding == ENCODE_INT16) {
+                for (size_t i=0; i<n; ++i) saturated += std::fabs(acc[i]) > range;
+            }
+            quantize_values(acc.data(), n, c.encoding, 0, c.scale, (unsigned short*)data);
+        }
+    });
+    if (saturated) {
+        cout << "Warning: " << saturated << " values lie beyond the int16 range of +-" << range
+             << " and were saturated.\n";
+    }
+    cout << "Wrote the result on a " << a.ni << " " << a.nj << " " << a.nk << " grid to " << output << ".\n";
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// CSG and offset operations on the phi grids of existing binary SDF files.
+enum SDFOperation {
+    SDF_UNION,        // min of all inputs
+    SDF_INTERSECTION, // max of all inputs
+    SDF_DIFFERENCE,   // the first input minus all others: max(a, -b, ...)
+    SDF_OFFSET        // the first input grown by a distance: a - d
+};
+
+// Parses "union", "intersection", "difference" or "offset".
+SDFOperation sdf_operation_from_string(std::string s);
+
+// Applies op to the phi channel of the first grid of each input (only the first
+// input for SDF_OFFSET) and writes the result as a binary SDF file on the lattice
+// and in the phi encoding of the first input.  Inputs on the same lattice are
+// combined value by value; others are trilinearly resampled onto it, and beyond
+// their bounds take the boundary value plus the distance to the bounds.  int16
+// output is rescaled to cover the widest int16 input band (plus the offset
+// distance), and values still beyond it are counted in a warning.  The inputs are
+// mapped and the output is written slab by slab along k, so memory use is bounded
+// by a few slabs whatever the grid size.
+void run_sdf_operation(SDFOperation op, std::string output,
+                       const std::vector<std::string> &inputs, float distance=0);
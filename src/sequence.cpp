@@ -0,0 +1,230 @@
+#include "sequence.h"
+#include "makelevelset3.h"
+#include "mesh_query.h"
+#include "string_tools.h"
+#include "vtk_output.h"
+#include <cstdio>
+#include <limits>
+
+using std::cout;
+
+// Reads a frame list: one frame per line, either a mesh file name with the same
+// triangles as the base mesh, or the 12 numbers r00 r01 r02 t0 r10 ... r22 t2.
+std::vector<Frame> read_frame_list(std::string filename) {
+    std::vector<Frame> frames;
+    std::fstream infile(filename);
+    if (!infile) {
+        std::cerr << "Failed to open " << filename << ". Terminating.\n";
+        exit(-1);
+    }
+    int line_number = 0;
+    while (infile) {
+        auto line = split(read_line(infile));
+        ++line_number;
+        if (line.empty() || line[0][0] == '#') continue;
+        if (line.size() != 1 && line.size() != 12) {
+            std::cerr << "Error: Line " << line_number << " of " << filename << " has " << line.size()
+                      << " fields; expected a mesh file or 12 transform numbers.\n";
+            exit(-1);
+        }
+        Frame f;
+        f.rigid = line.size() == 12;
+        if (f.rigid) {
+            for (int r=0; r<3; ++r) {
+                for (int c=0; c<3; ++c) f.R[3*r+c] = from_string<float>(line[4*r+c]);
+                f.t[r] = from_string<float>(line[4*r+3]);
+            }
+        }
+        else f.filename = line[0];
+        frames.push_back(f);
+    }
+    cout << "Read " << frames.size() << " frames from " << filename << ".\n";
+    return frames;
+}
+
+// Affine map y = M*x + b.
+struct AffineMap {
+    float M[9];
+    Vec3f b;
+    Vec3f operator()(const Vec3f &x) const {
+        return Vec3f(M[0]*x[0]+M[1]*x[1]+M[2]*x[2]+b[0],
+                     M[3]*x[0]+M[4]*x[1]+M[5]*x[2]+b[1],
+                     M[6]*x[0]+M[7]*x[1]+M[8]*x[2]+b[2]);
+    }
+};
+
+// Map taking points of frame f back to the matching points of frame ref.
+static AffineMap rigid_pullback(const Frame &ref, const Frame &f) {
+    AffineMap A;
+    // M = Rref * Rf^T, b = tref - M*tf
+    for (int r=0; r<3; ++r) for (int c=0; c<3; ++c) {
+        A.M[3*r+c] = 0;
+        for (int m=0; m<3; ++m) A.M[3*r+c] += ref.R[3*r+m]*f.R[3*c+m];
+    }
+    Vec3f tf(f.t[0], f.t[1], f.t[2]);
+    A.b = Vec3f(ref.t[0], ref.t[1], ref.t[2]);
+    A.b -= Vec3f(A.M[0]*tf[0]+A.M[1]*tf[1]+A.M[2]*tf[2],
+                 A.M[3]*tf[0]+A.M[4]*tf[1]+A.M[5]*tf[2],
+                 A.M[6]*tf[0]+A.M[7]*tf[1]+A.M[8]*tf[2]);
+    return A;
+}
+
+// True if grid coordinates g lie in a grid of n nodes (up to a small tolerance).
+static bool in_grid(const Vec3f &g, const Vec3ui &n) {
+    const float tol = 1e-4f;
+    for (int d=0; d<3; ++d) {
+        if (g[d] < -tol || g[d] > n[d]-1+tol) return false;
+    }
+    return true;
+}
+
+// Returns an error bound for pulling grid nodes back through A and interpolating.
+// A 1-Lipschitz field interpolated at a point p is off by at most sum_c w_c |p-c|
+// over the corners c of its cell: 0 at a node, 0.5dx half way along an edge and
+// sqrt(3)/2 dx at the cell centre.  The bound is the largest of these over the
+// nodes landing inside the grid (resample computes the others exactly), and
+// nothing when A maps nodes onto nodes.
+static float resample_error_bound(const AffineMap &A, const Vec3f &origin, float dx,
+                                  const Vec3ui &n) {
+    const float tol = 1e-4f;
+    bool aligned = true;
+    for (int m=0; m<9; ++m) {
+        float a = std::fabs(A.M[m]);
+        if (a > tol && std::fabs(a-1) > tol) aligned = false;
+    }
+    Vec3f shift = (A(origin) - origin)/dx;
+    for (int d=0; d<3; ++d) {
+        if (std::fabs(shift[d] - std::floor(shift[d]+0.5f)) > tol) aligned = false;
+    }
+    if (aligned) return 0;
+    float bound = 0;
+    #pragma omp parallel for reduction(max:bound)
+    for (int k=0; k<(int)n[2]; ++k) for (int j=0; j<(int)n[1]; ++j) for (int i=0; i<(int)n[0]; ++i) {
+        Vec3f g = (A(Vec3f(i*dx+origin[0], j*dx+origin[1], k*dx+origin[2])) - origin)/dx, f;
+        if (!in_grid(g, n)) continue;
+        for (int d=0; d<3; ++d) f[d] = g[d] - std::floor(g[d]);
+        float e = 0;
+        for (int c=0; c<8; ++c) {
+            Vec3f w, offset;
+            for (int d=0; d<3; ++d) {
+                bool up = c>>d & 1;
+                w[d] = up ? f[d] : 1-f[d];
+                offset[d] = up ? 1-f[d] : f[d];
+            }
+            e += w[0]*w[1]*w[2]*mag(offset);
+        }
+        bound = max(bound, e);
+    }
+    return bound*dx;
+}
+
+// phi(x) = ref_phi(A(x)) by trilinear interpolation.  Nodes whose image lies outside
+// the grid get the exact signed distance to the mesh tri/x instead.
+static void resample(const Array3f &ref_phi, const AffineMap &A, const Vec3f &origin, float dx,
+                     const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x, Array3f &phi) {
+    int ni=ref_phi.ni, nj=ref_phi.nj, nk=ref_phi.nk;
+    Vec3ui n(ni, nj, nk);
+    phi.resize(ni, nj, nk);
+    std::vector<Vec3f> outside;
+    std::vector<size_t> outside_index;
+    for (int k=0; k<nk; ++k) for (int j=0; j<nj; ++j) for (int i=0; i<ni; ++i) {
+        Vec3f p(i*dx+origin[0], j*dx+origin[1], k*dx+origin[2]);
+        Vec3f g = (A(p) - origin)/dx;
+        if (!in_grid(g, n)) {
+            outside.push_back(p);
+            outside_index.push_back(i + (size_t)ni*(j + (size_t)nj*k));
+            continue;
+        }
+        int i0, j0, k0;
+        float fx, fy, fz;
+        get_barycentric(g[0], i0, fx, 0, ni);
+        get_barycentric(g[1], j0, fy, 0, nj);
+        get_barycentric(g[2], k0, fz, 0, nk);
+        phi(i,j,k) = trilerp(ref_phi(i0,j0,k0),   ref_phi(i0+1,j0,k0),
+                             ref_phi(i0,j0+1,k0), ref_phi(i0+1,j0+1,k0),
+                             ref_phi(i0,j0,k0+1), ref_phi(i0+1,j0,k0+1),
+                             ref_phi(i0,j0+1,k0+1), ref_phi(i0+1,j0+1,k0+1),
+                             fx, fy, fz);
+    }
+    if (outside.empty()) return;
+    std::vector<float> exact;
+    signed_distance_at_points(tri, x, outside, exact);
+    for (size_t q=0; q<outside.size(); ++q) phi.a[outside_index[q]] = exact[q];
+}
+
+// Computes one distance field per frame on the grid of the base mesh.
+void make_level_set_sequence(const Triangulation &base, const std::vector<Frame> &frames,
+                             const Vec3f &origin, float dx, const Vec3ui &sizes,
+                             std::string basename, float tolerance) {
+    const float inf = std::numeric_limits<float>::infinity();
+    Array3f phi, ref_phi;
+    Array3i closest_tri;
+    // Vertices of the last computed frame, and how much further from exact its
+    // closest_tri may be than a full recompute (see update_level_set3).
+    std::vector<Vec3f> warm_x;
+    float warm_error = inf;
+    // Last exactly computed rigid frame, used for resampling.
+    const Frame *ref = nullptr;
+
+    for (size_t f=0; f<frames.size(); ++f) {
+        std::vector<Vec3f> x;
+        if (frames[f].rigid) {
+            x.resize(base.vertList.size());
+            const float *R = frames[f].R, *t = frames[f].t;
+            for (size_t v=0; v<x.size(); ++v) {
+                const Vec3f &p = base.vertList[v];
+                x[v] = Vec3f(R[0]*p[0]+R[1]*p[1]+R[2]*p[2]+t[0],
+                             R[3]*p[0]+R[4]*p[1]+R[5]*p[2]+t[1],
+                             R[6]*p[0]+R[7]*p[1]+R[8]*p[2]+t[2]);
+            }
+        }
+        else {
+            auto mesh = read_mesh(frames[f].filename);
+            if (mesh.vertList.size() != base.vertList.size()
+                    || mesh.faceList.size() != base.faceList.size()) {
+                std::cerr << "Error: Frame " << frames[f].filename
+                          << " does not match the topology of the base mesh.\n";
+                exit(-1);
+            }
+            x.swap(mesh.vertList);
+        }
+
+        // Largest vertex displacement since the last computed frame.
+        float delta = warm_x.empty() ? inf : 0.f;
+        for (size_t v=0; v<warm_x.size(); ++v) delta = max(delta, dist(x[v], warm_x[v]));
+
+        float resample_error = inf;
+        AffineMap A;
+        if (ref && frames[f].rigid) {
+            A = rigid_pullback(*ref, frames[f]);
+            resample_error = resample_error_bound(A, origin, dx, sizes);
+        }
+
+        cout << "Frame " << f << ": ";
+        if (resample_error <= tolerance) {
+            resample(ref_phi, A, origin, dx, base.faceList, x, phi);
+            cout << "resampled, error bound " << resample_error << ".\n";
+        }
+        else if (warm_error + 2*delta <= tolerance) {
+            update_level_set3(base.faceList, x, origin, dx, phi, closest_tri);
+            warm_error += 2*delta;
+            warm_x.swap(x);
+            cout << "warm-started, error bound " << warm_error << ".\n";
+        }
+        else {
+            make_level_set3(base.faceList, x, origin, dx, sizes[0], sizes[1], sizes[2],
+                            phi, closest_tri);
+            warm_error = 0;
+            warm_x.swap(x);
+            if (frames[f].rigid) {
+                ref = &frames[f];
+                ref_phi = phi;
+            }
+            cout << "recomputed.\n";
+        }
+
+        char suffix[32];
+        std::snprintf(suffix, sizeof(suffix), "_%04d.vtr", (int)f);
+        write_as_vtk(basename + suffix, phi, origin, origin + dx*Vec3f(sizes-Vec3ui(1,1,1)));
+    }
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "readers.h"
+
+// One frame of an animated mesh sequence.
+struct Frame {
+    // True if the frame is a rigid transform of the base mesh, false if it
+    // supplies new vertex positions.
+    bool rigid;
+    // Row-major rotation and translation, x' = R*x + t (rigid frames only).
+    float R[9], t[3];
+    // Mesh file holding the moved vertices (deforming frames only).
+    std::string filename;
+};
+
+// Reads a frame list: one frame per line, either a mesh file name with the same
+// triangles as the base mesh, or the 12 numbers r00 r01 r02 t0 r10 ... r22 t2.
+// Blank lines and lines starting with # are skipped; any other line is an error.
+std::vector<Frame> read_frame_list(std::string filename);
+
+// Computes one distance field per frame on the grid of the base mesh, written to
+// <basename>_<frame>.vtr.  Each frame is warm-started from the closest triangles of
+// the last computed frame, or for rigid frames resampled from the last exactly
+// computed rigid frame, whenever the error bound stays below tolerance.
+void make_level_set_sequence(const Triangulation &base, const std::vector<Frame> &frames,
+                             const Vec3f &origin, float dx, const Vec3ui &sizes,
+                             std::string basename, float tolerance);
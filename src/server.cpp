@@ -0,0 +1,196 @@
+#include "server.h"
+#include "sampler.h"
+#include <chrono>
+#include <cstring>
+#include <csignal>
+#include <iostream>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using std::cout;
+
+// Trilinear interpolation of phi at x, with the gradient of the interpolant.
+float sample_trilinear(const SDFGrid &g, const Channel &phi, const Vec3f &x, Vec3f *gradient) {
+    Vec3f f = (x - g.origin)/g.dx;
+    int i, j, k;
+    float fx, fy, fz;
+    get_barycentric(f[0], i, fx, 0, g.ni);
+    get_barycentric(f[1], j, fy, 0, g.nj);
+    get_barycentric(f[2], k, fz, 0, g.nk);
+    size_t n = i + (size_t)g.ni*(j + (size_t)g.nj*k);
+    size_t di = 1, dj = g.ni, dk = (size_t)g.ni*g.nj;
+    float v000 = phi[n],       v100 = phi[n+di];
+    float v010 = phi[n+dj],    v110 = phi[n+di+dj];
+    float v001 = phi[n+dk],    v101 = phi[n+di+dk];
+    float v011 = phi[n+dj+dk], v111 = phi[n+di+dj+dk];
+    if (gradient) {
+        (*gradient)[0] = bilerp(v100-v000, v110-v010, v101-v001, v111-v011, fy, fz)/g.dx;
+        (*gradient)[1] = bilerp(v010-v000, v110-v100, v011-v001, v111-v101, fx, fz)/g.dx;
+        (*gradient)[2] = bilerp(v001-v000, v101-v100, v011-v010, v111-v110, fx, fy)/g.dx;
+    }
+    return trilerp(v000, v100, v010, v110, v001, v101, v011, v111, fx, fy, fz);
+}
+
+// Reads or writes exactly n bytes; returns false if the connection closed.
+static bool read_all(int fd, void *buffer, size_t n) {
+    char *p = (char*)buffer;
+    while (n) {
+        ssize_t r = read(fd, p, n);
+        if (r <= 0) return false;
+        p += r; n -= r;
+    }
+    return true;
+}
+
+static bool write_all(int fd, const void *buffer, size_t n) {
+    const char *p = (const char*)buffer;
+    while (n) {
+        ssize_t r = write(fd, p, n);
+        if (r <= 0) return false;
+        p += r; n -= r;
+    }
+    return true;
+}
+
+// Samples phi at the points into reply: the values, then the gradients (x, y, z) if
+// wanted.  Float grids go through the batched sample_grid, which needs the points as
+// separate coordinate arrays (held in scratch); 16-bit grids are decoded point by
+// point with sample_trilinear.
+static void sample_points(const SDFGrid &g, const Channel &phi, const std::vector<Vec3f> &points,
+                          bool want_gradient, std::vector<float> &scratch, float *reply) {
+    size_t n = points.size();
+    if (phi.encoding != ENCODE_FLOAT32) {
+        Vec3f *gradients = want_gradient ? (Vec3f*)(reply + n) : nullptr;
+        for (size_t q=0; q<n; ++q) {
+            reply[q] = sample_trilinear(g, phi, points[q], gradients ? gradients+q : nullptr);
+        }
+        return;
+    }
+    scratch.resize(n*(want_gradient ? 6 : 3));
+    float *x = &scratch[0], *y = x + n, *z = y + n;
+    for (size_t q=0; q<n; ++q) {
+        x[q] = points[q][0];
+        y[q] = points[q][1];
+        z[q] = points[q][2];
+    }
+    float *gx = want_gradient ? z + n : nullptr;
+    float *gy = gx ? gx + n : nullptr, *gz = gy ? gy + n : nullptr;
+    GridView view = {(const float*)phi.data(), g.ni, g.nj, g.nk, g.origin, g.dx};
+    sample_grid(view, n, x, y, z, reply, gx, gy, gz);
+    for (size_t q=0; want_gradient && q<n; ++q) {
+        reply[n+3*q] = gx[q];
+        reply[n+3*q+1] = gy[q];
+        reply[n+3*q+2] = gz[q];
+    }
+}
+
+// Answers requests on one client connection until it closes.
+static void serve_client(int fd, const std::vector<SDFGrid> *grids) {
+    std::vector<Vec3f> points;
+    std::vector<float> reply, scratch;
+    QueryHeader h;
+    while (read_all(fd, &h, sizeof(h))) {
+        if (h.count > max_query_points) {
+            std::cerr << "Closing a connection that asked for " << h.count << " points (at most "
+                      << max_query_points << " per request).\n";
+            break;
+        }
+        const Channel *phi = h.grid < grids->size() ? (*grids)[h.grid].find("phi") : nullptr;
+        if (!phi) {
+            std::cerr << "Closing a connection that asked for grid " << h.grid << " (serving "
+                      << grids->size() << ").\n";
+            break;
+        }
+        size_t count = h.count;
+        points.resize(count);
+        if (count && !read_all(fd, &points[0], count*sizeof(Vec3f))) break;
+        bool want_gradient = h.flags & QUERY_GRADIENT;
+        reply.resize(count*(want_gradient ? 4 : 1));
+        if (count) sample_points((*grids)[h.grid], *phi, points, want_gradient, scratch, &reply[0]);
+        if (!reply.empty() && !write_all(fd, &reply[0], reply.size()*sizeof(float))) break;
+    }
+    close(fd);
+}
+
+// Maps the given binary SDF files and answers queries on socket_path until killed.
+void run_server(std::string socket_path, const std::vector<std::string> &files) {
+    // A client that disconnects before reading its reply must only end its own
+    // connection (write_all fails), not raise SIGPIPE and stop the server.
+    signal(SIGPIPE, SIG_IGN);
+    // Grids are never released, so client threads can share them freely.
+    auto grids = new std::vector<SDFGrid>;
+    for (auto &f: files) {
+        for (auto &g: map_binary(f)) {
+            if (!g.find("phi")) continue;
+            cout << "Grid " << grids->size() << ": " << f << " level " << g.level << ", "
+                 << g.ni << "x" << g.nj << "x" << g.nk << ", dx " << g.dx << ".\n";
+            grids->push_back(g);
+        }
+    }
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Error: Socket path " << socket_path << " is too long.\n";
+        exit(-1);
+    }
+    std::strcpy(addr.sun_path, socket_path.c_str());
+    unlink(socket_path.c_str());
+    if (server < 0 || bind(server, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(server, 64) != 0) {
+        std::cerr << "Error: Cannot listen on " << socket_path << ".\n";
+        exit(-1);
+    }
+    cout << "Serving " << grids->size() << " grids on " << socket_path << ".\n";
+    while (true) {
+        int client = accept(server, nullptr, nullptr);
+        if (client < 0) continue;
+        std::thread(serve_client, client, grids).detach();
+    }
+}
+
+// Sends random queries inside the bounds of grid and reports the throughput.
+void run_query_benchmark(std::string socket_path, const SDFGrid &grid, unsigned int grid_index,
+                         unsigned int num_points, unsigned int batch_size, bool gradients) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path)-1);
+    if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        std::cerr << "Error: Cannot connect to " << socket_path << ".\n";
+        exit(-1);
+    }
+    batch_size = clamp(batch_size, 1u, max_query_points);
+    Vec3f extent = grid.dx*Vec3f(grid.ni-1, grid.nj-1, grid.nk-1);
+    std::vector<Vec3f> points(num_points);
+    for (unsigned int q=0; q<num_points; ++q) {
+        points[q] = grid.origin + Vec3f(randhashf(3*q, 0, extent[0]),
+                                        randhashf(3*q+1, 0, extent[1]),
+                                        randhashf(3*q+2, 0, extent[2]));
+    }
+    std::vector<float> reply;
+    const Channel *phi = grid.find("phi");
+    float max_error = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int first=0; first<num_points; first+=batch_size) {
+        QueryHeader h = {grid_index, min(batch_size, num_points-first), gradients ? (unsigned int)QUERY_GRADIENT : 0u};
+        reply.resize(h.count*(gradients ? 4 : 1));
+        if (!write_all(fd, &h, sizeof(h)) || !write_all(fd, &points[first], h.count*sizeof(Vec3f))
+                || !read_all(fd, &reply[0], reply.size()*sizeof(float))) {
+            std::cerr << "Error: Connection to " << socket_path << " lost.\n";
+            exit(-1);
+        }
+        // Spot check the first reply of each batch against local sampling.
+        if (phi) {
+            max_error = max(max_error, std::fabs(reply[0] - sample_trilinear(grid, *phi, points[first], nullptr)));
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    close(fd);
+    cout << num_points << " queries in batches of " << batch_size << ": " << seconds << " s, "
+         << num_points/seconds << " queries/s (max spot check error " << max_error << ").\n";
+}
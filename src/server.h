@@ -0,0 +1,34 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "binary_output.h"
+
+// Batched point queries against SDF grids loaded by a local server process.
+//
+// A client connects to the server's Unix domain socket and sends requests made
+// of a QueryHeader followed by count points (x, y, z floats).  The server replies
+// with count interpolated distances, followed by count gradients (x, y, z floats)
+// when QUERY_GRADIENT is set.  Requests on one connection are answered in order.
+// A request may hold at most max_query_points points and must name a served grid;
+// otherwise the server logs the request and closes the connection without replying.
+const unsigned int max_query_points = 1 << 20;
+
+struct QueryHeader {
+    // Index of the grid, counting the records of all served files in order.
+    unsigned int grid;
+    unsigned int count;
+    unsigned int flags;
+};
+enum { QUERY_GRADIENT = 1 };
+
+// Trilinearly interpolates the phi channel of g at x (clamped to the grid), and
+// optionally its gradient.
+float sample_trilinear(const SDFGrid &g, const Channel &phi, const Vec3f &x, Vec3f *gradient);
+
+// Maps the given binary SDF files and answers queries on socket_path until killed.
+void run_server(std::string socket_path, const std::vector<std::string> &files);
+
+// Sends num_points random queries inside the bounds of grid in batches of
+// batch_size and reports the throughput in queries per second.
+void run_query_benchmark(std::string socket_path, const SDFGrid &grid, unsigned int grid_index,
+                         unsigned int num_points, unsigned int batch_size, bool gradients);
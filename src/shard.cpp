@@ -0,0 +1,152 @@
+#include "shard.h"
+#include "binary_output.h"
+#include "mesh_order.h"
+#include "mesh_query.h"
+#include <algorithm>
+#include <iostream>
+
+using std::cout;
+
+void shard_layers(int shard, int num_shards, int nk, int &k0, int &k1) {
+    k0 = (int)((long long)nk*shard/num_shards);
+    k1 = (int)((long long)nk*(shard+1)/num_shards);
+}
+
+// Sample positions every stride nodes in [begin, end), always including end-1.
+static std::vector<int> lattice(int begin, int end, int stride) {
+    std::vector<int> v;
+    for (int a=begin; a<end; a+=stride) v.push_back(a);
+    if (v.empty() || v.back() != end-1) v.push_back(end-1);
+    return v;
+}
+
+int shard_halo(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+               const Vec3f &origin, float dx, const Vec3ui &sizes, int k0, int k1,
+               float max_distance) {
+    float reach = max_distance;
+    if (reach <= 0) {
+        const int stride = 8;
+        auto is = lattice(0, sizes[0], stride), js = lattice(0, sizes[1], stride), ks = lattice(k0, k1, stride);
+        long long count = (long long)is.size()*js.size()*ks.size();
+        TriangleBVH bvh(tri, x);
+        float largest = 0;
+        #pragma omp parallel for schedule(dynamic, 64) reduction(max:largest)
+        for (long long n=0; n<count; ++n) {
+            int i = is[n%is.size()], j = js[n/is.size()%js.size()], k = ks[n/is.size()/js.size()];
+            int closest = -1;
+            float d = bvh.distance(origin + dx*Vec3f(i, j, k), closest);
+            if (d > largest) largest = d;
+        }
+        // Distance is 1-Lipschitz and every node is within half a lattice diagonal
+        // of a sample.
+        reach = largest + 0.5f*std::sqrt(3.f)*stride*dx;
+    }
+    return min((int)std::ceil(reach/dx) + 1, (int)sizes[2]);
+}
+
+// Drops all but layers k0..k1-1 of a, in place.
+template <typename T>
+static void keep_layers(Array3<T, Array1<T> > &a, int k0, int k1) {
+    size_t layer = (size_t)a.ni*a.nj;
+    std::copy(a.a.data + k0*layer, a.a.data + k1*layer, a.a.data);
+    a.resize(a.ni, a.nj, k1-k0);
+}
+
+void make_level_set_shard(const Triangulation &mesh, const Vec3f &origin, float dx,
+                          const Vec3ui &sizes, int k0, int k1, bool morton,
+                          Array3f &phi, Array3i &closest_tri, const LevelSetOptions &opts,
+                          LevelSetChannels *channels) {
+    int halo = shard_halo(mesh.faceList, mesh.vertList, origin, dx, sizes, k0, k1, opts.max_distance);
+    int lo = max(k0-halo, 0), hi = min(k1+halo, (int)sizes[2]);
+
+    // Keep the triangles that may cross a row of the haloed slab or reach its exact band.
+    float margin = (opts.exact_band+1)*dx;
+    float z0 = origin[2] + lo*dx - margin, z1 = origin[2] + (hi-1)*dx + margin;
+    std::vector<Vec3ui> tri;
+    std::vector<int> mesh_tri;
+    for (size_t t=0; t<mesh.faceList.size(); ++t) {
+        const Vec3ui &f = mesh.faceList[t];
+        float a = mesh.vertList[f[0]][2], b = mesh.vertList[f[1]][2], c = mesh.vertList[f[2]][2];
+        if (max(a, b, c) >= z0 && min(a, b, c) <= z1) {
+            tri.push_back(f);
+            mesh_tri.push_back(t);
+        }
+    }
+    cout << "Shard layers " << k0 << " to " << k1-1 << " with a halo of " << halo << " layers, "
+         << tri.size() << " of " << mesh.faceList.size() << " triangles.\n";
+
+    std::vector<Vec3f> x = mesh.vertList;
+    std::vector<int> original_tri;
+    if (morton) reorder_mesh(tri, x, original_tri);
+    // Objects of the kept triangles, in their new order.
+    LevelSetOptions shard_opts = opts;
+    std::vector<int> tri_object;
+    if (opts.tri_object) {
+        for (size_t t=0; t<tri.size(); ++t) {
+            tri_object.push_back((*opts.tri_object)[mesh_tri[morton ? original_tri[t] : t]]);
+        }
+        shard_opts.tri_object = &tri_object;
+    }
+    make_level_set3(tri, x, origin + Vec3f(0, 0, lo*dx), dx, sizes[0], sizes[1], hi-lo,
+                    phi, closest_tri, shard_opts, channels);
+
+    keep_layers(phi, k0-lo, k1-lo);
+    keep_layers(closest_tri, k0-lo, k1-lo);
+    for (int c=0; channels && channels->closest_points && c<3; ++c) {
+        keep_layers(channels->closest[c], k0-lo, k1-lo);
+    }
+    for (int c=0; channels && channels->gradients && c<3; ++c) {
+        keep_layers(channels->gradient[c], k0-lo, k1-lo);
+    }
+    if (channels && channels->objects) keep_layers(channels->object, k0-lo, k1-lo);
+    for (auto &t: closest_tri.a) {
+        if (t >= 0) t = mesh_tri[morton ? original_tri[t] : t];
+    }
+}
+
+void merge_shards(std::string output, const std::vector<std::string> &inputs) {
+    std::vector<SDFGrid> shards;
+    for (auto &f: inputs) {
+        auto grids = map_binary(f);
+        if (grids.size() != 1) {
+            std::cerr << "Error: " << f << " must hold exactly one grid.\n";
+            exit(-1);
+        }
+        shards.push_back(grids[0]);
+    }
+    std::vector<int> order(shards.size());
+    for (size_t s=0; s<order.size(); ++s) order[s] = s;
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+        return shards[a].origin[2] < shards[b].origin[2];
+    });
+
+    std::vector<SDFGrid> slabs;
+    const SDFGrid &first = shards[order[0]];
+    int nk = 0;
+    for (int s: order) {
+        const SDFGrid &g = shards[s];
+        bool fits = g.level == first.level && g.ni == first.ni && g.nj == first.nj
+                 && g.dx == first.dx && g.origin[0] == first.origin[0] && g.origin[1] == first.origin[1]
+                 && g.channels.size() == first.channels.size();
+        for (size_t c=0; fits && c<g.channels.size(); ++c) {
+            // Quantized shards must share a scale, i.e. be written with the same --band.
+            fits = g.channels[c].name == first.channels[c].name
+                && g.channels[c].encoding == first.channels[c].encoding
+                && g.channels[c].scale == first.channels[c].scale;
+        }
+        if (!fits) {
+            std::cerr << "Error: " << inputs[s] << " is not a shard of the same grid as " << inputs[order[0]] << ".\n";
+            exit(-1);
+        }
+        // Each shard must start at the layer after the previous one.
+        if (std::fabs(g.origin[2] - (first.origin[2] + nk*first.dx)) > 0.01f*first.dx) {
+            std::cerr << "Error: " << inputs[s] << " does not continue the layers before it (missing shard?).\n";
+            exit(-1);
+        }
+        nk += g.nk;
+        slabs.push_back(g);
+    }
+    write_slabs_as_binary(output, slabs);
+    cout << "Merged " << slabs.size() << " shards into " << output << " with dimensions "
+         << first.ni << " " << first.nj << " " << nk << ".\n";
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "readers.h"
+#include "makelevelset3.h"
+
+// Shard s of num_shards covers layers k0 <= k < k1 of a grid nk layers deep.
+// Shards are slabs along k, so every x-ray used for the inside/outside parity lies
+// within one shard, and shard files concatenate in storage order.
+void shard_layers(int shard, int num_shards, int nk, int &k0, int &k1);
+
+// Layers of halo needed on each side of layers k0..k1-1 so that every cell in
+// them has its closest triangle, and the cells between, inside the halo.  With
+// max_distance>0 only cells within max_distance need to be exact; otherwise the
+// largest distance in the slab is bounded from exact distances on a coarse lattice.
+int shard_halo(const std::vector<Vec3ui> &tri, const std::vector<Vec3f> &x,
+               const Vec3f &origin, float dx, const Vec3ui &sizes, int k0, int k1,
+               float max_distance);
+
+// Computes layers k0..k1-1 of the level set of mesh on the grid at origin with the
+// given sizes, as make_level_set3 would for the whole grid.  Only the triangles
+// near the slab plus its halo are used; closest_tri holds indices into mesh.
+void make_level_set_shard(const Triangulation &mesh, const Vec3f &origin, float dx,
+                          const Vec3ui &sizes, int k0, int k1, bool morton,
+                          Array3f &phi, Array3i &closest_tri, const LevelSetOptions &opts,
+                          LevelSetChannels *channels=nullptr);
+
+// Stitches binary shard files of one grid, given in any order, into a single grid
+// record in output.  The shards are mapped and streamed, never loaded whole.
+void merge_shards(std::string output, const std::vector<std::string> &inputs);
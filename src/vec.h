@@ -361,9 +361,12 @@ inline T triple(const Vec<3,T> &a, const Vec<3,T> &b, const Vec<3,T> &c)
 template<unsigned int N, class T>
 inline unsigned int hash(const Vec<N,T> &a)
 {
-   unsigned int h=a.v[0];
+   // the multiplicative hash() of hashtable.h, written out so this needs no other
+   // header; the first component is mixed too, since h=a.v[0]^a.v[1] would send
+   // every cell on a diagonal of small coordinates to the same value
+   unsigned int h=(unsigned int)a.v[0]*2654435769u;
    for(unsigned int i=1; i<N; ++i)
-      h=hash(h ^ a.v[i]);
+      h=(h ^ (unsigned int)a.v[i])*2654435769u;
    return h;
 }
 
@@ -14,7 +14,8 @@
 
 // Writes 3D grid to vtk rectilinear grid output.
 void write_as_vtk(std::string output, const Array3f &grid,
-                  const Vec3f &min_box, const Vec3f &max_box) {
+                  const Vec3f &min_box, const Vec3f &max_box,
+                  const Array3i *closest_tri, const LevelSetChannels *channels) {
     auto rect_grid = vtkSmartPointer<vtkRectilinearGrid>::New();
     rect_grid->SetExtent(1, grid.ni, 1, grid.nj, 1, grid.nk);
 
@@ -52,6 +53,32 @@ void write_as_vtk(std::string output, const Array3f &grid,
     }
     rect_grid->GetPointData()->AddArray(phi);
 
+    auto add_ints = [&](const char *name, const Array3i &v) {
+        auto array = vtkSmartPointer<vtkIntArray>::New();
+        array->SetName(name);
+        array->SetNumberOfComponents(1);
+        array->SetNumberOfTuples(grid.ni*grid.nj*grid.nk);
+        for (int i=0; i<grid.ni*grid.nj*grid.nk; ++i) {
+            array->SetComponent(i, 0, v.a[i]);
+        }
+        rect_grid->GetPointData()->AddArray(array);
+    };
+    if (closest_tri) add_ints("closest_tri", *closest_tri);
+    if (channels && channels->objects) add_ints("object", channels->object);
+    // Vector channels are stored one array per component.
+    auto add_vector = [&](const char *name, const Array3f *v) {
+        auto array = vtkSmartPointer<vtkDoubleArray>::New();
+        array->SetName(name);
+        array->SetNumberOfComponents(3);
+        array->SetNumberOfTuples(grid.ni*grid.nj*grid.nk);
+        for (int i=0; i<grid.ni*grid.nj*grid.nk; ++i) {
+            for (int c=0; c<3; ++c) array->SetComponent(i, c, v[c].a[i]);
+        }
+        rect_grid->GetPointData()->AddArray(array);
+    };
+    if (channels && channels->closest_points) add_vector("closest_point", channels->closest);
+    if (channels && channels->gradients)      add_vector("gradient", channels->gradient);
+
     auto writer = vtkSmartPointer<vtkXMLRectilinearGridWriter>::New();
     //! @todo user selects result file name.
     writer->SetFileName(output.c_str());
@@ -60,7 +87,8 @@ void write_as_vtk(std::string output, const Array3f &grid,
 }
 #else
 void write_as_vtk(std::string output, const Array3f &grid,
-                  const Vec3f &min_box, const Vec3f &max_box) {
+                  const Vec3f &min_box, const Vec3f &max_box,
+                  const Array3i *closest_tri, const LevelSetChannels *channels) {
     std::cerr << "Error: Not built with ENABLE_VTK\n";
 }
 #endif
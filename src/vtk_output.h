@@ -1,6 +1,10 @@
 #pragma once
 #include "vec.h"
 #include "array3.h"
+#include "makelevelset3.h"
+// Writes phi, plus the closest triangle indices and extra channels when given.
 void write_as_vtk(std::string output, const Array3f &grid,
-                  const Vec3f &min_box, const Vec3f &max_box);
+                  const Vec3f &min_box, const Vec3f &max_box,
+                  const Array3i *closest_tri=nullptr,
+                  const LevelSetChannels *channels=nullptr);
 